@@ -0,0 +1,520 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "bytecode.h"
+#include "global.h"
+#include "memory.h"
+#include "vm.h"
+
+// Functions and jump tables are read recursively, a file can't nest them deeper than this.
+#define MAX_FUNCTION_DEPTH 1024
+
+typedef enum {
+    CONSTANT_NIL,
+    CONSTANT_BOOL,
+    CONSTANT_NUMBER,
+    CONSTANT_STRING,
+    CONSTANT_FUNCTION,
+    CONSTANT_JUMP_TABLE,
+    CONSTANT_FUNCTION_REF
+} ConstantTag;
+
+/*
+ * Functions in the order they were written, a function in more than one chunk is written once.
+ * Held outside the collector's heap, growing it must not collect the script being written.
+ */
+static struct {
+    const ObjFunction **functions;
+    int count;
+    int capacity;
+} writtenFunctions;
+
+static void writeU8(FILE *file, const uint8_t value) {
+    fputc(value, file);
+}
+
+static void writeU16(FILE *file, const uint16_t value) {
+    writeU8(file, value & 0xff);
+    writeU8(file, value >> 8);
+}
+
+static void writeU32(FILE *file, const uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        writeU8(file, value >> i * 8 & 0xff);
+    }
+}
+
+static void writeU64(FILE *file, const uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        writeU8(file, value >> i * 8 & 0xff);
+    }
+}
+
+static void writeString(FILE *file, const ObjString *string) {
+    writeU32(file, string->length);
+    fwrite(string->chars, sizeof(char), string->length, file);
+}
+
+static bool writeFunction(FILE *file, const ObjFunction *function);
+
+static bool writeValue(FILE *file, const Value constant) {
+    if (IS_NIL(constant)) {
+        writeU8(file, CONSTANT_NIL);
+    } else if (IS_BOOL(constant)) {
+        writeU8(file, CONSTANT_BOOL);
+        writeU8(file, AS_BOOL(constant));
+    } else if (IS_NUMBER(constant)) {
+        const double number = AS_NUMBER(constant);
+        uint64_t bits;
+        memcpy(&bits, &number, sizeof(bits));
+        writeU8(file, CONSTANT_NUMBER);
+        writeU64(file, bits);
+    } else if (IS_STRING(constant)) {
+        writeU8(file, CONSTANT_STRING);
+        writeString(file, AS_STRING(constant));
+    } else if (IS_FUNCTION(constant)) {
+        // Inline guards compare functions by identity, a copy would never match.
+        for (int i = 0; i < writtenFunctions.count; i++) {
+            if (writtenFunctions.functions[i] == AS_FUNCTION(constant)) {
+                writeU8(file, CONSTANT_FUNCTION_REF);
+                writeU32(file, i);
+                return true;
+            }
+        }
+        writeU8(file, CONSTANT_FUNCTION);
+        return writeFunction(file, AS_FUNCTION(constant));
+    } else if (IS_JUMP_TABLE(constant)) {
+        // Only the targets are written, the dense index is rebuilt from them.
+        const Table *targets = &AS_JUMP_TABLE(constant)->targets;
+        writeU8(file, CONSTANT_JUMP_TABLE);
+        writeU32(file, AS_JUMP_TABLE(constant)->missTarget);
+        writeU32(file, targets->count);
+        int index = -1;
+        for (const Entry *entry = tableNextEntry(targets, &index); entry != NULL;
+             entry = tableNextEntry(targets, &index)) {
+            if (!writeValue(file, entry->key)) return false;
+            writeU32(file, (uint32_t) AS_NUMBER(entry->value));
+        }
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool writeFunction(FILE *file, const ObjFunction *function) {
+    if (writtenFunctions.count == writtenFunctions.capacity) {
+        writtenFunctions.capacity = GROW_CAPACITY(writtenFunctions.capacity);
+        writtenFunctions.functions = realloc(writtenFunctions.functions,
+                                             sizeof(const ObjFunction *) * writtenFunctions.capacity);
+        if (writtenFunctions.functions == NULL) exit(1);
+    }
+    writtenFunctions.functions[writtenFunctions.count++] = function;
+
+    writeU32(file, function->arity);
+    writeU32(file, function->upvalueCount);
+    writeU32(file, function->capturedCount);
+    writeU32(file, function->stackSlots);
+    writeU8(file, function->name != NULL);
+    if (function->name != NULL) writeString(file, function->name);
+
+    const Chunk *chunk = &function->chunk;
+    writeU32(file, chunk->count);
+    fwrite(chunk->code, sizeof(uint8_t), chunk->count, file);
+
+    writeU32(file, chunk->lineCount);
+    for (int i = 0; i < chunk->lineCount; i++) {
+        writeU32(file, chunk->lines[i].offset);
+        writeU32(file, chunk->lines[i].line);
+    }
+
+    writeU32(file, chunk->constants.count);
+    for (int i = 0; i < chunk->constants.count; i++) {
+        if (!writeValue(file, chunk->constants.values[i])) return false;
+    }
+
+    writeU32(file, chunk->inlineCount);
+    for (int i = 0; i < chunk->inlineCount; i++) {
+        writeU32(file, chunk->inlines[i].start);
+        writeU32(file, chunk->inlines[i].end);
+        writeU32(file, chunk->inlines[i].function);
+        writeU32(file, chunk->inlines[i].line);
+    }
+    return true;
+}
+
+bool writeBytecode(FILE *file, const ObjFunction *script) {
+    fwrite(BYTECODE_MAGIC, sizeof(char), BYTECODE_MAGIC_LENGTH, file);
+    writeU16(file, BYTECODE_VERSION);
+
+    writeU32(file, vm.globals.count);
+    for (int i = 0; i < vm.globals.count; i++) {
+        writeString(file, vm.globals.values[i].name);
+        writeU8(file, vm.globals.values[i].immutable);
+    }
+
+    const bool written = writeFunction(file, script);
+    free(writtenFunctions.functions);
+    writtenFunctions.functions = NULL;
+    writtenFunctions.count = 0;
+    writtenFunctions.capacity = 0;
+    return written && !ferror(file);
+}
+
+bool isBytecode(const uint8_t *data, const size_t size) {
+    return size >= BYTECODE_MAGIC_LENGTH && memcmp(data, BYTECODE_MAGIC, BYTECODE_MAGIC_LENGTH) == 0;
+}
+
+// Every read checks the bounds, once one fails the reader only returns zeroes.
+typedef struct {
+    const uint8_t *current;
+    const uint8_t *end;
+    bool failed;
+    // Every function read so far, in the order they were written.
+    ObjFunction **functions;
+    int functionCount;
+    int functionCapacity;
+} Reader;
+
+static bool canRead(Reader *reader, const size_t size) {
+    if (reader->failed || (size_t) (reader->end - reader->current) < size) {
+        reader->failed = true;
+        return false;
+    }
+    return true;
+}
+
+static uint64_t readLittleEndian(Reader *reader, const int size) {
+    if (!canRead(reader, size)) return 0;
+
+    uint64_t value = 0;
+    for (int i = 0; i < size; i++) {
+        value |= (uint64_t) reader->current[i] << i * 8;
+    }
+    reader->current += size;
+    return value;
+}
+
+#define READ_U8(reader)  ((uint8_t) readLittleEndian(reader, 1))
+#define READ_U16(reader) ((uint16_t) readLittleEndian(reader, 2))
+#define READ_U32(reader) ((uint32_t) readLittleEndian(reader, 4))
+#define READ_U64(reader) readLittleEndian(reader, 8)
+
+// Counts are stored as u32 but kept in ints.
+static int readCount(Reader *reader) {
+    const uint32_t count = READ_U32(reader);
+    if (count > INT32_MAX) {
+        reader->failed = true;
+        return 0;
+    }
+    return (int) count;
+}
+
+static ObjString *readString(Reader *reader) {
+    const int length = readCount(reader);
+    if (!canRead(reader, length)) return NULL;
+
+    ObjString *string = copyString((const char *) reader->current, length);
+    reader->current += length;
+    return string;
+}
+
+static ObjFunction *readFunction(Reader *reader, int depth);
+
+static Value readConstant(Reader *reader, int depth, int codeLength);
+
+// The targets have to stay inside the code of the function, which is read before its constants.
+static Value readJumpTable(Reader *reader, const int depth, const int codeLength) {
+    if (depth > MAX_FUNCTION_DEPTH) {
+        reader->failed = true;
+        return NIL_VAL;
+    }
+
+    ObjJumpTable *table = newJumpTable();
+    push(OBJ_VAL(table));
+
+    table->missTarget = readCount(reader);
+    if (table->missTarget >= codeLength) reader->failed = true;
+    const int count = readCount(reader);
+    for (int i = 0; i < count && !reader->failed; i++) {
+        const Value key = readConstant(reader, depth + 1, codeLength);
+        push(key);
+        const int target = readCount(reader);
+        if ((!IS_NUMBER(key) && !IS_STRING(key)) || target >= codeLength) {
+            reader->failed = true;
+        } else {
+            tableSet(&table->targets, key, NUMBER_VAL(target));
+        }
+        pop();
+    }
+    finishJumpTable(table);
+
+    pop();
+    return OBJ_VAL(table);
+}
+
+static Value readConstant(Reader *reader, const int depth, const int codeLength) {
+    switch (READ_U8(reader)) {
+        case CONSTANT_NIL:
+            return NIL_VAL;
+        case CONSTANT_BOOL:
+            return BOOL_VAL(READ_U8(reader) != 0);
+        case CONSTANT_NUMBER: {
+            const uint64_t bits = READ_U64(reader);
+            double number;
+            memcpy(&number, &bits, sizeof(number));
+            return NUMBER_VAL(number);
+        }
+        case CONSTANT_STRING: {
+            ObjString *string = readString(reader);
+            return string == NULL ? NIL_VAL : OBJ_VAL(string);
+        }
+        case CONSTANT_FUNCTION: {
+            ObjFunction *function = readFunction(reader, depth + 1);
+            return function == NULL ? NIL_VAL : OBJ_VAL(function);
+        }
+        case CONSTANT_JUMP_TABLE:
+            return readJumpTable(reader, depth, codeLength);
+        case CONSTANT_FUNCTION_REF: {
+            const int index = readCount(reader);
+            if (index >= reader->functionCount) {
+                reader->failed = true;
+                return NIL_VAL;
+            }
+            return OBJ_VAL(reader->functions[index]);
+        }
+        default:
+            reader->failed = true;
+            return NIL_VAL;
+    }
+}
+
+static bool isConstant(const Chunk *chunk, const int index) {
+    return index >= 0 && index < chunk->constants.count;
+}
+
+static bool isStringConstant(const Chunk *chunk, const int index) {
+    return isConstant(chunk, index) && IS_STRING(chunk->constants.values[index]);
+}
+
+/*
+ * The captures of an OP_CLOSURE at offset. Locals have to be on the stack below depth, or be the
+ * slot the new closure goes to, which a local function uses to call itself. The others have to be
+ * upvalues of function. Each kind fills the closure's slots for it, so the counts have
+ * to match what the new closure was allocated with.
+ */
+static bool verifyCaptures(const ObjFunction *function, const int offset, const Instruction *instruction,
+                           const int depth) {
+    const uint8_t *code = function->chunk.code;
+    const ObjFunction *closed = AS_FUNCTION(function->chunk.constants.values[instruction->index]);
+    int upvalues = 0;
+    int captured = 0;
+    for (int at = offset + (instruction->wide ? 5 : 2); at < instruction->next;) {
+        const uint8_t flags = code[at++];
+        int index = code[at++];
+        if (flags & UPVALUE_WIDE) {
+            index = index << 16 | code[at] << 8 | code[at + 1];
+            at += 2;
+        }
+
+        switch (flags & ~UPVALUE_WIDE) {
+            case UPVALUE_LOCAL:
+                if (index > depth) return false;
+                upvalues++;
+                break;
+            case 0:
+                if (index >= function->upvalueCount) return false;
+                upvalues++;
+                break;
+            case UPVALUE_LOCAL | UPVALUE_BY_VALUE:
+                if (index > depth) return false;
+                captured++;
+                break;
+            case UPVALUE_BY_VALUE:
+                if (index >= function->capturedCount) return false;
+                captured++;
+                break;
+            default:
+                return false;
+        }
+    }
+    return upvalues == closed->upvalueCount && captured == closed->capturedCount;
+}
+
+// Checks the operands of one instruction that runs with depth values in the frame.
+static bool verifyInstruction(const ObjFunction *function, const int offset, const int depth) {
+    const Chunk *chunk = &function->chunk;
+    Instruction instruction;
+    decodeInstruction(chunk, offset, &instruction);
+
+    switch (instruction.code) {
+        case OP_CONSTANT:
+            return isConstant(chunk, instruction.index);
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_INC_LOCAL:
+        case OP_DEC_LOCAL:
+            return instruction.index < depth;
+        case OP_GET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL:
+            return instruction.index < vm.globals.count;
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+            return instruction.index < function->upvalueCount;
+        case OP_GET_CAPTURED:
+            return instruction.index < function->capturedCount;
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_GET_SUPER:
+        case OP_INVOKE:
+        case OP_SUPER_INVOKE:
+        case OP_CLASS:
+        case OP_METHOD:
+            return isStringConstant(chunk, instruction.index);
+        case OP_INLINE_GUARD:
+            return isConstant(chunk, instruction.index) && IS_FUNCTION(chunk->constants.values[instruction.index]);
+        case OP_CLOSURE:
+            return verifyCaptures(function, offset, &instruction, depth);
+        default:
+            // Jumps, switch targets and stack counts are checked by chunkStackDepth.
+            return true;
+    }
+}
+
+/*
+ * The VM trusts the operands of the code it runs, so loaded code is checked before it gets there.
+ * chunkStackDepth checks the jumps and that the stack stays within stackSlots, every operand
+ * that indexes something is checked against what it indexes. Code no path reaches never runs
+ * and is left alone. What kind of value an instruction finds on the stack is not checked.
+ */
+static bool verifyCode(const ObjFunction *function) {
+    const Chunk *chunk = &function->chunk;
+    if (chunk->count == 0) return false;
+    int *depths = malloc(sizeof(int) * chunk->count);
+    if (depths == NULL) exit(1);
+
+    const int maxDepth = chunkStackDepth(chunk, function->arity, depths);
+    bool valid = maxDepth != -1 && function->stackSlots >= maxDepth + FRAME_EXTRA_SLOTS;
+    for (int offset = 0; valid && offset < chunk->count; offset++) {
+        if (depths[offset] >= 0) valid = verifyInstruction(function, offset, depths[offset]);
+    }
+
+    free(depths);
+    return valid;
+}
+
+// The function stays on the stack while it is read, reading its constants can collect.
+static ObjFunction *readFunction(Reader *reader, const int depth) {
+    if (depth > MAX_FUNCTION_DEPTH) {
+        reader->failed = true;
+        return NULL;
+    }
+
+    ObjFunction *function = newFunction();
+    push(OBJ_VAL(function));
+    if (reader->functionCount == reader->functionCapacity) {
+        const int oldCapacity = reader->functionCapacity;
+        reader->functionCapacity = GROW_CAPACITY(oldCapacity);
+        reader->functions = GROW_ARRAY(ObjFunction *, reader->functions, oldCapacity, reader->functionCapacity);
+    }
+    reader->functions[reader->functionCount++] = function;
+
+    function->arity = readCount(reader);
+    function->upvalueCount = readCount(reader);
+    function->capturedCount = readCount(reader);
+    function->stackSlots = readCount(reader);
+    if (READ_U8(reader)) function->name = readString(reader);
+
+    Chunk *chunk = &function->chunk;
+    const int codeLength = readCount(reader);
+    if (codeLength > 0 && canRead(reader, codeLength)) {
+        chunk->code = GROW_ARRAY(uint8_t, NULL, 0, codeLength);
+        memcpy(chunk->code, reader->current, codeLength);
+        chunk->count = codeLength;
+        chunk->capacity = codeLength;
+        reader->current += codeLength;
+    }
+
+    const int lineCount = readCount(reader);
+    if (lineCount > 0 && canRead(reader, (size_t) lineCount * 8)) {
+        chunk->lines = GROW_ARRAY(LineStart, NULL, 0, lineCount);
+        chunk->lineCapacity = lineCount;
+        for (int i = 0; i < lineCount; i++) {
+            chunk->lines[i].offset = (int) READ_U32(reader);
+            chunk->lines[i].line = (int) READ_U32(reader);
+        }
+        chunk->lineCount = lineCount;
+    }
+
+    const int constantCount = readCount(reader);
+    for (int i = 0; i < constantCount && !reader->failed; i++) {
+        addConstant(chunk, readConstant(reader, depth, chunk->count));
+    }
+
+    // Stack traces print the name of the inlined function, it has to be a named one.
+    const int inlineCount = readCount(reader);
+    for (int i = 0; i < inlineCount && !reader->failed; i++) {
+        const int start = readCount(reader);
+        const int end = readCount(reader);
+        const int inlined = readCount(reader);
+        const int line = readCount(reader);
+        if (start > end || end > chunk->count || inlined >= chunk->constants.count ||
+            !IS_FUNCTION(chunk->constants.values[inlined]) || AS_FUNCTION(chunk->constants.values[inlined])->name == NULL) {
+            reader->failed = true;
+        } else {
+            addInlineRange(chunk, start, end, inlined, line);
+        }
+    }
+
+    if (!reader->failed && !verifyCode(function)) reader->failed = true;
+
+    pop();
+    return reader->failed ? NULL : function;
+}
+
+/*
+ * Code refers to globals by index, so every global has to end up at the index it had when the
+ * file was written. The natives are defined first by every VM, a file written by a VM with
+ * different natives doesn't line up and is rejected.
+ */
+static void readGlobals(Reader *reader) {
+    const int count = readCount(reader);
+    for (int i = 0; i < count && !reader->failed; i++) {
+        ObjString *name = readString(reader);
+        const bool immutable = READ_U8(reader) != 0;
+        if (name == NULL) return;
+
+        push(OBJ_VAL(name));
+        int index;
+        if (lookUpGlobal(&vm.globals, name, &index)) {
+            if (IS_IMMUTABLE_GLOBAL(index) != immutable) reader->failed = true;
+        } else {
+            index = declareGlobal(&vm.globals, name, immutable);
+        }
+        pop();
+
+        if (index != i) reader->failed = true;
+    }
+}
+
+ObjFunction *readBytecode(const uint8_t *data, const size_t size) {
+    if (!isBytecode(data, size)) return NULL;
+
+    Reader reader;
+    reader.current = data + BYTECODE_MAGIC_LENGTH;
+    reader.end = data + size;
+    reader.failed = false;
+    reader.functions = NULL;
+    reader.functionCount = 0;
+    reader.functionCapacity = 0;
+
+    if (READ_U16(&reader) != BYTECODE_VERSION) return NULL;
+
+    readGlobals(&reader);
+    ObjFunction *script = readFunction(&reader, 0);
+    FREE_ARRAY(ObjFunction *, reader.functions, reader.functionCapacity);
+    if (reader.failed || reader.current != reader.end) return NULL;
+    // The script is called without arguments and has nothing around it to capture.
+    if (script->arity != 0 || script->upvalueCount != 0 || script->capturedCount != 0) return NULL;
+    return script;
+}
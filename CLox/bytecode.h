@@ -0,0 +1,38 @@
+#ifndef clox_bytecode_h
+#define clox_bytecode_h
+
+#include <stdio.h>
+
+#include "common.h"
+#include "object.h"
+
+#define BYTECODE_MAGIC "CLOXBC"
+#define BYTECODE_MAGIC_LENGTH 6
+// Bump whenever the encoding of instructions or of the file itself changes.
+#define BYTECODE_VERSION 4
+
+/*
+ * Compiled scripts can be saved and run later without going through the compiler.
+ * A file holds, all integers little endian:
+ *  magic, u16 version
+ *  u32 global count, then for every global: string name, u8 immutable
+ *  the script function
+ * A function is u32 arity, upvalue count, captured count and stack slots, u8 has name (+ string name),
+ * u32 code length + code, u32 line count + (u32 offset, u32 line) pairs,
+ * u32 constant count + constants, u32 inline range count + (u32 start, end, function constant, line).
+ * A constant is a u8 tag followed by nothing (nil), a u8 (bool), a u64 (number bits),
+ * a string (u32 length + chars), a function, a jump table or a u32 function reference.
+ * Functions are numbered in the order they are written, starting with the script, a function
+ * in more than one chunk is written the first time and referenced after that.
+ * A jump table is a u32 miss offset and a u32 case count + (constant, u32 code offset) pairs.
+ * Globals are stored in index order, code refers to them by index.
+ */
+
+bool isBytecode(const uint8_t *data, size_t size);
+
+bool writeBytecode(FILE *file, const ObjFunction *script);
+
+// Returns NULL if the data is malformed or was written for a different VM.
+ObjFunction *readBytecode(const uint8_t *data, size_t size);
+
+#endif //clox_bytecode_h
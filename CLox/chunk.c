@@ -1,3 +1,5 @@
+#include <stdlib.h>
+
 #include "chunk.h"
 
 #include "memory.h"
@@ -10,12 +12,16 @@ void initChunk(Chunk *chunk) {
     chunk->lineCount = 0;
     chunk->lineCapacity = 0;
     chunk->lines = NULL;
+    chunk->inlineCount = 0;
+    chunk->inlineCapacity = 0;
+    chunk->inlines = NULL;
     initValueArray(&chunk->constants);
 }
 
 void freeChunk(Chunk *chunk) {
     FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-    FREE_ARRAY(LineStart, chunk->lines, chunk->capacity);
+    FREE_ARRAY(LineStart, chunk->lines, chunk->lineCapacity);
+    FREE_ARRAY(InlineRange, chunk->inlines, chunk->inlineCapacity);
     freeValueArray(&chunk->constants);
     initChunk(chunk);
 }
@@ -117,3 +123,322 @@ int getLine(const Chunk *chunk, const size_t instruction) {
         }
     }
 }
+
+void addInlineRange(Chunk *chunk, const int start, const int end, const int function, const int line) {
+    if (chunk->inlineCapacity < chunk->inlineCount + 1) {
+        const int oldCapacity = chunk->inlineCapacity;
+        chunk->inlineCapacity = GROW_CAPACITY(oldCapacity);
+        chunk->inlines = GROW_ARRAY(InlineRange, chunk->inlines, oldCapacity, chunk->inlineCapacity);
+    }
+
+    InlineRange *range = &chunk->inlines[chunk->inlineCount++];
+    range->start = start;
+    range->end = end;
+    range->function = function;
+    range->line = line;
+}
+
+// Reads a big endian operand of size bytes at *at, false if it runs past the end of the code.
+static bool readOperand(const Chunk *chunk, int *at, const int size, int *value) {
+    if (chunk->count - *at < size) return false;
+
+    *value = 0;
+    for (int i = 0; i < size; i++) {
+        *value = *value << 8 | chunk->code[(*at)++];
+    }
+    return true;
+}
+
+/*
+ * Reads the instruction at offset with the same operand sizes as the VM, false if it isn't
+ * a known instruction or its operands run past the end of the code.
+ */
+bool decodeInstruction(const Chunk *chunk, const int offset, Instruction *instruction) {
+    int at = offset;
+    if (at >= chunk->count) return false;
+    instruction->wide = chunk->code[at] == OP_WIDE;
+    if (instruction->wide && ++at == chunk->count) return false;
+    if (chunk->code[at] == OP_WIDE || chunk->code[at] > OP_METHOD) return false;
+
+    instruction->code = chunk->code[at++];
+    instruction->index = -1;
+    instruction->count = 0;
+    instruction->target = -1;
+    const int indexSize = instruction->wide ? 3 : 1;
+    const int offsetSize = instruction->wide ? 3 : 2;
+
+    int jump;
+    switch (instruction->code) {
+        case OP_CONSTANT:
+        case OP_POPN:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_GET_CAPTURED:
+        case OP_SET_PROPERTY:
+        case OP_GET_PROPERTY:
+        case OP_GET_SUPER:
+        case OP_SWITCH:
+        case OP_CLASS:
+        case OP_METHOD:
+            if (!readOperand(chunk, &at, indexSize, &instruction->index)) return false;
+            break;
+        case OP_INC_LOCAL:
+        case OP_DEC_LOCAL:
+        case OP_INVOKE:
+        case OP_SUPER_INVOKE:
+            if (!readOperand(chunk, &at, indexSize, &instruction->index) ||
+                !readOperand(chunk, &at, 1, &instruction->count)) {
+                return false;
+            }
+            break;
+        case OP_JOIN_STR:
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        case OP_SUPER_INIT:
+            if (!readOperand(chunk, &at, 1, &instruction->count)) return false;
+            break;
+        case OP_JUMP:
+        case OP_JUMP_IF_TRUE:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_NOT_EQUAL:
+            if (!readOperand(chunk, &at, offsetSize, &jump)) return false;
+            instruction->target = at + jump;
+            break;
+        case OP_LOOP:
+        case OP_LOOP_IF_FALSE:
+            if (!readOperand(chunk, &at, offsetSize, &jump)) return false;
+            instruction->target = at - jump;
+            break;
+        case OP_INLINE_GUARD:
+            if (!readOperand(chunk, &at, indexSize, &instruction->index) ||
+                !readOperand(chunk, &at, offsetSize, &jump)) {
+                return false;
+            }
+            instruction->target = at + jump;
+            break;
+        case OP_CLOSURE: {
+            // The captures that follow are counted by the function, so it has to be one.
+            if (!readOperand(chunk, &at, indexSize, &instruction->index) ||
+                instruction->index >= chunk->constants.count ||
+                !IS_FUNCTION(chunk->constants.values[instruction->index])) {
+                return false;
+            }
+            const ObjFunction *function = AS_FUNCTION(chunk->constants.values[instruction->index]);
+            for (int i = 0; i < function->upvalueCount + function->capturedCount; i++) {
+                int flags, index;
+                if (!readOperand(chunk, &at, 1, &flags) ||
+                    !readOperand(chunk, &at, flags & UPVALUE_WIDE ? 3 : 1, &index)) {
+                    return false;
+                }
+            }
+            break;
+        }
+        default:
+            break;
+    }
+
+    instruction->next = at;
+    return true;
+}
+
+/*
+ * Values an instruction takes off the stack and puts back when it carries on with the next one.
+ * OP_SUPER_INIT leaves the arguments in place when there is no superclass initializer, so it
+ * is counted as keeping them.
+ */
+static void stackEffect(const Instruction *instruction, int *pops, int *pushes) {
+    *pops = 0;
+    *pushes = 0;
+    switch (instruction->code) {
+        case OP_CONSTANT:
+        case OP_CONSTANT_M1:
+        case OP_CONSTANT_0:
+        case OP_CONSTANT_1:
+        case OP_CONSTANT_2:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_GET_LOCAL:
+        case OP_INC_LOCAL:
+        case OP_DEC_LOCAL:
+        case OP_GET_GLOBAL:
+        case OP_GET_UPVALUE:
+        case OP_GET_CAPTURED:
+        case OP_CLOSURE:
+        case OP_CLASS:
+            *pushes = 1;
+            break;
+        case OP_POP:
+        case OP_DEFINE_GLOBAL:
+        case OP_PRINT:
+        case OP_CLOSE_UPVALUE:
+        case OP_RETURN:
+        case OP_INLINE_GUARD:
+            *pops = 1;
+            break;
+        case OP_POPN:
+            *pops = instruction->index;
+            break;
+        case OP_DUP:
+            *pops = 1;
+            *pushes = 2;
+            break;
+        case OP_SET_LOCAL:
+        case OP_SET_GLOBAL:
+        case OP_SET_UPVALUE:
+        case OP_GET_PROPERTY:
+        case OP_NOT:
+        case OP_NEGATE:
+        case OP_JUMP_IF_TRUE:
+        case OP_JUMP_IF_FALSE:
+        case OP_SWITCH:
+        case OP_LOOP_IF_FALSE:
+            *pops = 1;
+            *pushes = 1;
+            break;
+        case OP_SET_PROPERTY:
+        case OP_GET_SUPER:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_MOD:
+        case OP_SHIFT_RIGHT:
+        case OP_SHIFT_LEFT:
+        case OP_BIT_AND:
+        case OP_BIT_OR:
+        case OP_BIT_XOR:
+        case OP_INHERIT:
+        case OP_METHOD:
+            *pops = 2;
+            *pushes = 1;
+            break;
+        case OP_JUMP_IF_NOT_EQUAL:
+            *pops = 2;
+            *pushes = 2;
+            break;
+        case OP_JOIN_STR:
+            *pops = instruction->count;
+            *pushes = 1;
+            break;
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        case OP_INVOKE:
+            *pops = instruction->count + 1;
+            *pushes = 1;
+            break;
+        case OP_SUPER_INVOKE:
+            *pops = instruction->count + 2;
+            *pushes = 1;
+            break;
+        case OP_SUPER_INIT:
+            *pops = instruction->count + 1;
+            *pushes = instruction->count + 1;
+            break;
+        default:
+            break;
+    }
+}
+
+// Gives the instruction at offset its depth, or checks it against the one it already has.
+static bool reachInstruction(int *depths, int *pending, int *pendingCount, const int count, const int offset,
+                             const int depth) {
+    if (offset < 0 || offset >= count || depths[offset] == -2) return false;
+    if (depths[offset] != -1) return depths[offset] == depth;
+
+    depths[offset] = depth;
+    pending[(*pendingCount)++] = offset;
+    return true;
+}
+
+// Follows every path from the start of the code, see chunkStackDepth.
+static int walkStack(const Chunk *chunk, const int arity, int *depths, int *pending) {
+    Instruction instruction;
+    for (int offset = 0; offset < chunk->count; offset++) {
+        depths[offset] = -2;
+    }
+    for (int offset = 0; offset < chunk->count; offset = instruction.next) {
+        if (!decodeInstruction(chunk, offset, &instruction)) return -1;
+        depths[offset] = -1;
+    }
+
+    int pendingCount = 0;
+    int maxDepth = arity + 1;
+    reachInstruction(depths, pending, &pendingCount, chunk->count, 0, maxDepth);
+    while (pendingCount > 0) {
+        const int offset = pending[--pendingCount];
+        const int depth = depths[offset];
+        decodeInstruction(chunk, offset, &instruction);
+
+        int pops, pushes;
+        stackEffect(&instruction, &pops, &pushes);
+        if (pops > depth) return -1;
+        const int after = depth - pops + pushes;
+        if (after > maxDepth) maxDepth = after;
+
+        bool valid = true;
+        switch (instruction.code) {
+            case OP_RETURN:
+                break;
+            case OP_JUMP:
+            case OP_LOOP:
+                valid = reachInstruction(depths, pending, &pendingCount, chunk->count, instruction.target, depth);
+                break;
+            case OP_INLINE_GUARD:
+                // The guard only takes the callee off when it runs the inlined body.
+                valid = reachInstruction(depths, pending, &pendingCount, chunk->count, instruction.target, depth) &&
+                        reachInstruction(depths, pending, &pendingCount, chunk->count, instruction.next, after);
+                break;
+            case OP_SWITCH: {
+                if (instruction.index >= chunk->constants.count ||
+                    !IS_JUMP_TABLE(chunk->constants.values[instruction.index])) {
+                    return -1;
+                }
+                const ObjJumpTable *table = AS_JUMP_TABLE(chunk->constants.values[instruction.index]);
+                valid = reachInstruction(depths, pending, &pendingCount, chunk->count, table->missTarget, depth);
+                int index = -1;
+                for (const Entry *entry = tableNextEntry(&table->targets, &index); valid && entry != NULL;
+                     entry = tableNextEntry(&table->targets, &index)) {
+                    valid = IS_NUMBER(entry->value) &&
+                            reachInstruction(depths, pending, &pendingCount, chunk->count,
+                                             (int) AS_NUMBER(entry->value), depth);
+                }
+                break;
+            }
+            default:
+                valid = reachInstruction(depths, pending, &pendingCount, chunk->count, instruction.next, after) &&
+                        (instruction.target == -1 ||
+                         reachInstruction(depths, pending, &pendingCount, chunk->count, instruction.target, after));
+                break;
+        }
+        if (!valid) return -1;
+    }
+    return maxDepth;
+}
+
+/*
+ * Deepest the stack gets while running chunk, counted from the callee slot of the frame, which
+ * starts out holding the callee and its arity arguments. Every path to an instruction has to
+ * reach it with the same depth. -1 if that doesn't hold, a jump leaves the code or lands inside
+ * an instruction, or the code takes more values off the stack than the frame has.
+ * If depths isn't NULL it gets the depth before each instruction of the chunk, -2 for offsets
+ * inside an instruction and -1 for instructions no path reaches.
+ */
+int chunkStackDepth(const Chunk *chunk, const int arity, int *depths) {
+    if (chunk->count == 0) return -1;
+
+    int *buffer = malloc(sizeof(int) * chunk->count * (depths == NULL ? 2 : 1));
+    if (buffer == NULL) exit(1);
+    if (depths == NULL) depths = buffer + chunk->count;
+    const int maxDepth = walkStack(chunk, arity, depths, buffer);
+    free(buffer);
+    return maxDepth;
+}
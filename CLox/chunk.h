@@ -4,6 +4,7 @@
 #include "common.h"
 #include "value.h"
 
+// Changing the instructions or their operands changes the bytecode file format, see BYTECODE_VERSION.
 typedef enum {
     OP_WIDE,
     OP_CONSTANT,
@@ -26,6 +27,7 @@ typedef enum {
     OP_SET_GLOBAL,
     OP_GET_UPVALUE,
     OP_SET_UPVALUE,
+    OP_GET_CAPTURED,
     OP_SET_PROPERTY,
     OP_GET_PROPERTY,
     OP_GET_SUPER,
@@ -50,9 +52,12 @@ typedef enum {
     OP_JUMP_IF_TRUE,
     OP_JUMP_IF_FALSE,
     OP_JUMP_IF_NOT_EQUAL,
+    OP_SWITCH,
+    OP_INLINE_GUARD,
     OP_LOOP,
     OP_LOOP_IF_FALSE,
     OP_CALL,
+    OP_TAIL_CALL,
     OP_INVOKE,
     OP_SUPER_INVOKE,
     OP_SUPER_INIT,
@@ -64,11 +69,38 @@ typedef enum {
     OP_METHOD
 } OpCode;
 
+// Flags of the first operand byte for each upvalue of an OP_CLOSURE.
+#define UPVALUE_LOCAL    0x01
+#define UPVALUE_BY_VALUE 0x02
+// The index that follows is a u24 instead of a u8.
+#define UPVALUE_WIDE     0x04
+
 typedef struct {
     int offset;
     int line;
 } LineStart;
 
+// Code in [start, end) is the body of the function at constant index function, inlined by a call on line.
+typedef struct {
+    int start;
+    int end;
+    int function;
+    int line;
+} InlineRange;
+
+// An instruction as decodeInstruction reads it, offsets are from the start of the chunk.
+typedef struct {
+    OpCode code;
+    bool wide;
+    // The constant, local, upvalue or global operand, or the count of an OP_POPN. -1 if there is none.
+    int index;
+    // Arguments of a call or OP_JOIN_STR, the step of OP_INC_LOCAL and OP_DEC_LOCAL.
+    int count;
+    // Where a jump, loop or guard goes, -1 for every other instruction.
+    int target;
+    int next;
+} Instruction;
+
 typedef struct {
     int count;
     int capacity;
@@ -77,6 +109,10 @@ typedef struct {
     int lineCount;
     int lineCapacity;
     LineStart *lines;
+    // Nested ranges come before the ones around them.
+    int inlineCount;
+    int inlineCapacity;
+    InlineRange *inlines;
 } Chunk;
 
 void initChunk(Chunk *chunk);
@@ -97,4 +133,10 @@ bool writeConstant(Chunk *chunk, Value value, int line);
 
 int getLine(const Chunk *chunk, size_t instruction);
 
+void addInlineRange(Chunk *chunk, int start, int end, int function, int line);
+
+bool decodeInstruction(const Chunk *chunk, int offset, Instruction *instruction);
+
+int chunkStackDepth(const Chunk *chunk, int arity, int *depths);
+
 #endif // clox_chunk_h
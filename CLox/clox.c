@@ -1,60 +1,108 @@
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "bytecode.h"
 #include "common.h"
+#include "compiler.h"
 #include "vm.h"
+#include "utils/io.h"
 
-static char *readFile(const char *path) {
-    FILE *file = fopen(path, "rb");
-    if (file == NULL) {
+static SourceFile openFile(const char *path) {
+    SourceFile file;
+    if (!openSourceFile(path, &file)) {
         fprintf(stderr, "Could not open file \"%s\".\n", path);
         exit(74);
     }
+    return file;
+}
 
-    fseek(file, 0L, SEEK_END);
-    const size_t fileSize = ftell(file);
-    rewind(file);
+static InterpretResult runSourceFile(const char *path) {
+    SourceFile file = openFile(path);
+    const uint8_t *data = (const uint8_t *) file.data;
+    const InterpretResult result = isBytecode(data, file.size)
+                                       ? interpretBytecode(data, file.size)
+                                       : interpret(file.data, file.size);
+    closeSourceFile(&file);
+    return result;
+}
 
-    char *buffer = malloc(fileSize + 1);
-    if (buffer == NULL) {
-        fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
-        exit(74);
+static void runFile(const char *path) {
+    const InterpretResult result = runSourceFile(path);
+    if (result == INTERPRET_COMPILE_ERROR)
+        exit(65);
+    if (result == INTERPRET_RUNTIME_ERROR)
+        exit(70);
+}
+
+// Writes the bytecode of the script at path to outPath, or next to it with a 'c' appended.
+static void compileFile(const char *path, const char *outPath) {
+    SourceFile source = openFile(path);
+    const ObjFunction *function = compile(source.data, source.size);
+    closeSourceFile(&source);
+
+    if (function == NULL)
+        exit(65);
+
+    char *defaultPath = NULL;
+    if (outPath == NULL) {
+        defaultPath = malloc(strlen(path) + 2);
+        if (defaultPath == NULL) exit(1);
+        strcpy(defaultPath, path);
+        strcat(defaultPath, "c");
+        outPath = defaultPath;
     }
 
-    const size_t bytesRead = fread(buffer, sizeof(char), fileSize, file);
-    if (bytesRead < fileSize) {
-        fprintf(stderr, "Could not read file \"%s\".\n", path);
+    FILE *file = fopen(outPath, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", outPath);
         exit(74);
     }
 
-    buffer[bytesRead] = '\0';
-    fclose(file);
-    return buffer;
+    const bool written = writeBytecode(file, function);
+    if (fclose(file) != 0 || !written) {
+        fprintf(stderr, "Could not write file \"%s\".\n", outPath);
+        exit(74);
+    }
+    free(defaultPath);
 }
 
-static void runFile(const char *path) {
-    char *source = readFile(path);
-    const InterpretResult result = interpret(source);
-    free(source);
-
-    if (result == INTERPRET_COMPILE_ERROR)
-        exit(65);
-    if (result == INTERPRET_RUNTIME_ERROR)
-        exit(70);
+static bool isBlank(const char *text, const size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (!isspace((unsigned char) text[i])) return false;
+    }
+    return true;
 }
 
+/*
+ * Every input runs as its own script against the globals left by the ones before it.
+ * Input that stops in the middle of a declaration keeps collecting lines, a blank line
+ * gives up on it and reports the errors.
+ */
 static void repl() {
-    char line[1024];
+    InputBuffer input;
+    initInputBuffer(&input);
+
     for (;;) {
-        printf(">  ");
+        printf(input.length == 0 ? ">  " : ".. ");
 
-        if (!fgets(line, sizeof(line), stdin)) {
+        const size_t lineStart = input.length;
+        if (!appendLine(stdin, &input)) {
             printf("\n");
+            if (input.length > 0) interpret(input.data, input.length);
             break;
         }
 
-        interpret(line);
+        if (lineStart > 0 && isBlank(input.data + lineStart, input.length - lineStart)) {
+            interpret(input.data, input.length);
+        } else if (interpretReplInput(input.data, input.length) == INTERPRET_INCOMPLETE) {
+            continue;
+        }
+        input.length = 0;
     }
+
+    freeInputBuffer(&input);
 }
 
 int main(const int argc, const char *argv[]) {
@@ -64,8 +112,14 @@ int main(const int argc, const char *argv[]) {
         repl();
     } else if (argc == 2) {
         runFile(argv[1]);
+    } else if (argc == 3 && strcmp(argv[1], "-i") == 0) {
+        // Whatever the script set up stays around for the session, even if it failed half way.
+        runSourceFile(argv[2]);
+        repl();
+    } else if ((argc == 3 || argc == 4) && strcmp(argv[1], "-c") == 0) {
+        compileFile(argv[2], argc == 4 ? argv[3] : NULL);
     } else {
-        fprintf(stderr, "Usage: clox [path]\n");
+        fprintf(stderr, "Usage: clox [path]\n       clox -i path\n       clox -c path [output]\n");
         exit(64);
     }
 
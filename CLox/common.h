@@ -22,6 +22,11 @@
 // #define DEBUG_LOG_GC
 #endif
 
+#ifndef NO_INLINE_CALLS
+// Uncomment the line below to compile every call to a small global function as a real call
+// #define NO_INLINE_CALLS
+#endif
+
 #define UINT8_COUNT (UINT8_MAX + 1)
 #define UINT24_MAX (16777215)
 #define UINT24_COUNT (UINT24_MAX + 1)
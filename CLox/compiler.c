@@ -10,6 +10,7 @@
 #include "memory.h"
 #include "scanner.h"
 #include "object.h"
+#include "table.h"
 #include "value.h"
 #include "vm.h"
 
@@ -17,11 +18,21 @@
 #include "debug.h"
 #endif // DEBUG_PRINT_CODE
 
+#define MAX_SCOPE_DEPTH (64 * UINT8_COUNT)
+// Bounds on the functions that get inlined, past them a call costs less than the copied code.
+#define INLINE_MAX_TOKENS 24
+#define INLINE_MAX_PARAMS 8
+
 typedef struct {
     Token current;
     Token previous;
     bool hadError;
     bool panicMode;
+    // A function needed a forward jump past UINT16_MAX, the script gets compiled again.
+    bool jumpOverflow;
+    // Set by compileReplInput, running out of source before anything else went wrong is not an error.
+    bool allowIncomplete;
+    bool incomplete;
 } Parser;
 
 typedef enum {
@@ -74,11 +85,20 @@ typedef struct {
     int depth;
     bool immutable;
     bool isCaptured;
+    // False while a function declaration compiles its own body, its slot gets filled by OP_CLOSURE.
+    bool hasValue;
 } Local;
 
+/*
+ * byValue upvalues capture a variable that can never change, the closure keeps
+ * a copy of the value instead of an ObjUpvalue.
+ * slot is the index in the closure's upvalues or its captured values.
+ */
 typedef struct {
     int index;
     bool isLocal;
+    bool byValue;
+    int slot;
 } Upvalue;
 
 typedef enum {
@@ -95,14 +115,26 @@ typedef struct Compiler {
     FunctionType type;
     int anonymousFunctionCount;
 
-    Local locals[UINT8_COUNT];
+    Local *locals;
     int localCapacity;
     int localCount;
-    Upvalue upvalues[UINT8_COUNT];
+    Upvalue *upvalues;
+    int upvalueCapacity;
     int scopeDepth;
 
+    // Where the function starts in the source, identifies it again when the script is recompiled.
+    const char *source;
+    // Forward jumps take a 24 bit offset behind OP_WIDE, set for functions that overflowed 16 bits.
+    bool wideJumps;
+
     int controlFlowTop;
     ControlFlowContext controlFlowStack[MAX_LOOP_DEPTH];
+
+    // Offset of the last OP_CALL, lets return turn it into a tail call.
+    int lastCall;
+
+    // Index of every string and number constant in the chunk, so repeated ones share a slot.
+    Table constants;
 } Compiler;
 
 typedef struct ClassCompiler {
@@ -114,6 +146,65 @@ Parser parser;
 Compiler *current = NULL;
 ClassCompiler *currentClass = NULL;
 
+// Source starts of the functions whose forward jumps overflowed, they get wide jumps in the next pass.
+static struct {
+    const char **sources;
+    int count;
+    int capacity;
+} wideFunctions;
+
+/*
+ * Identifiers seen during one compile, keyed on their text in the source.
+ * Every use of a name after the first skips interning it, and every use as a global
+ * after the first skips looking it up in vm.globals.
+ */
+typedef struct {
+    const char *start;
+    int length;
+    uint32_t hash;
+    ObjString *string;
+    // Index of the global with this name, -1 until it is used as one.
+    int global;
+    // Index in inlineTemplates of the top level function with this name, -1 if there is none.
+    int inlineTemplate;
+} Identifier;
+
+typedef struct {
+    int count;
+    int capacity;
+    Identifier *entries;
+} IdentifierCache;
+
+static IdentifierCache identifiers;
+
+/*
+ * A top level function whose body is `return <expression>;`, where the expression makes no calls
+ * and assigns nothing. Calls to it with literals or locals as arguments compile the expression in
+ * place of the call, every parameter replaced by its argument. Nothing else runs while the
+ * expression does, so an argument read anywhere in it has the value it had at the call.
+ */
+typedef struct {
+    ObjFunction *function;
+    // Right after the 'return', the expression is scanned again from there at every call.
+    Scanner body;
+    Token params[INLINE_MAX_PARAMS];
+    int arity;
+} InlineTemplate;
+
+typedef struct {
+    const InlineTemplate *template;
+    Token arguments[INLINE_MAX_PARAMS];
+} InlineExpansion;
+
+static struct {
+    InlineTemplate *entries;
+    int count;
+    int capacity;
+} inlineTemplates;
+
+// The call whose expression is compiling, its names are parameters or globals.
+static const InlineExpansion *inlining = NULL;
+
 static Chunk *currentChunk() {
     return &current->function->chunk;
 }
@@ -122,11 +213,24 @@ static ControlFlowContext *currentControlFlow() {
     return current->controlFlowTop >= 0 ? &current->controlFlowStack[current->controlFlowTop] : NULL;
 }
 
+// The source ran out in the middle of a declaration or a string.
+static bool endsEarly(const Token *token) {
+    if (token->type == TOKEN_EOF) return true;
+    return token->type == TOKEN_ERROR && strcmp(token->start, "Unterminated string.") == 0;
+}
+
 static void errorAt(const Token *token, const char *message) {
-    if (parser.panicMode)
+    if (parser.panicMode || parser.incomplete)
         return;
     parser.panicMode = true;
 
+    // Input that stops early may go on in the next line, unless an error before it made that moot.
+    if (parser.allowIncomplete && !parser.hadError && endsEarly(token)) {
+        parser.incomplete = true;
+        parser.hadError = true;
+        return;
+    }
+
     fprintf(stderr, "[line %d] Error", token->line);
     if (token->type == TOKEN_EOF) {
         fprintf(stderr, " at end");
@@ -159,14 +263,15 @@ static bool errorIfImmutable(const Token *name, const BindingKind kind, const in
             const Compiler *compiler = current;
             const Upvalue *upvalue = &compiler->upvalues[index];
             while (!upvalue->isLocal) {
-                upvalue = &compiler->upvalues[upvalue->index];
                 compiler = compiler->enclosing;
+                upvalue = &compiler->upvalues[upvalue->index];
             }
 
-            if (compiler->locals[upvalue->index].immutable) {
+            if (compiler->enclosing->locals[upvalue->index].immutable) {
                 errorAt(name, "Can not assign value to a constant variable.");
                 return true;
             }
+            break;
         }
         case BINDING_GLOBAL:
             if (IS_IMMUTABLE_GLOBAL(index)) {
@@ -219,21 +324,37 @@ static void emitBytes(const uint8_t byte1, const uint8_t byte2) {
     emitByte(byte2);
 }
 
+// The offset is known up front, so only loops that need it get the wide form.
 static void emitLoop(const OpCode loopOp, const int loopStart) {
-    emitByte(loopOp);
+    // +3 for the instruction itself and its offset.
+    int offset = currentChunk()->count - loopStart + 3;
+    if (offset <= UINT16_MAX) {
+        emitByte(loopOp);
+        emitByte((offset >> 8) & 0xff);
+        emitByte(offset & 0xff);
+        return;
+    }
 
-    const int offset = currentChunk()->count - loopStart + 2;
-    if (offset > UINT16_MAX) error("Loop body too large.");
+    offset += 2;
+    if (offset > UINT24_MAX) error("Loop body too large.");
 
+    emitBytes(OP_WIDE, loopOp);
+    emitByte((offset >> 16) & 0xff);
     emitByte((offset >> 8) & 0xff);
     emitByte(offset & 0xff);
 }
 
+static int jumpSize() {
+    return current->wideJumps ? 3 : 2;
+}
+
 static int emitJump(const uint8_t instruction) {
+    if (current->wideJumps) emitByte(OP_WIDE);
     emitByte(instruction);
-    emitByte(0xff);
-    emitByte(0xff);
-    return currentChunk()->count - 2;
+    for (int i = 0; i < jumpSize(); i++) {
+        emitByte(0xff);
+    }
+    return currentChunk()->count - jumpSize();
 }
 
 static void emitReturn() {
@@ -268,24 +389,94 @@ static void emitPopTo(const int targetDepth) {
     emitPop(popCount);
 }
 
+static void emitIndex(const OpCode code, const int index, const int line) {
+    const bool result = writeIndex(code, currentChunk(), index, line);
+    if (!result) error("Too many identifier in one chunk.");
+}
+
 static int makeConstant(const Value value) {
+    const bool shared = IS_STRING(value) || IS_NUMBER(value);
+    Value existing;
+    if (shared && tableGet(&current->constants, value, &existing)) {
+        return (int) AS_NUMBER(existing);
+    }
+
     const int index = addConstant(currentChunk(), value);
     if (index > UINT24_MAX) {
         error("Too many constants in one chunk.");
         return 0;
     }
 
+    if (shared) tableSet(&current->constants, value, NUMBER_VAL(index));
     return index;
 }
 
+static Identifier *findIdentifier(Identifier *entries, const int capacity, const char *start, const int length,
+                                  const uint32_t hash) {
+    uint32_t index = hash & (capacity - 1);
+    for (;;) {
+        Identifier *entry = &entries[index];
+        if (entry->start == NULL ||
+            (entry->hash == hash && entry->length == length && memcmp(entry->start, start, length) == 0)) {
+            return entry;
+        }
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+static void growIdentifiers() {
+    const int capacity = GROW_CAPACITY(identifiers.capacity);
+    Identifier *entries = ALLOCATE(Identifier, capacity);
+    for (int i = 0; i < capacity; i++) {
+        entries[i].start = NULL;
+    }
+
+    for (int i = 0; i < identifiers.capacity; i++) {
+        const Identifier *entry = &identifiers.entries[i];
+        if (entry->start == NULL) continue;
+        *findIdentifier(entries, capacity, entry->start, entry->length, entry->hash) = *entry;
+    }
+
+    FREE_ARRAY(Identifier, identifiers.entries, identifiers.capacity);
+    identifiers.entries = entries;
+    identifiers.capacity = capacity;
+}
+
+// The pointer is only valid until the next identifier is added.
+static Identifier *cachedIdentifier(const Token *name) {
+    if (identifiers.count + 1 > identifiers.capacity * TABLE_MAX_LOAD) {
+        growIdentifiers();
+    }
+
+    const uint32_t hash = hashString(name->start, name->length);
+    Identifier *entry = findIdentifier(identifiers.entries, identifiers.capacity, name->start, name->length, hash);
+    if (entry->start == NULL) {
+        // Interning can collect, the entry only becomes visible to the collector once it is filled in.
+        ObjString *string = copyString(name->start, name->length);
+        entry->start = name->start;
+        entry->length = name->length;
+        entry->hash = hash;
+        entry->string = string;
+        entry->global = -1;
+        entry->inlineTemplate = -1;
+        identifiers.count++;
+    }
+    return entry;
+}
+
+static void freeIdentifiers() {
+    FREE_ARRAY(Identifier, identifiers.entries, identifiers.capacity);
+    identifiers.count = 0;
+    identifiers.capacity = 0;
+    identifiers.entries = NULL;
+}
+
 static int makeIdentifier(const Token *name) {
-    return makeConstant(OBJ_VAL(copyString(name->start,
-        name->length)));
+    return makeConstant(OBJ_VAL(cachedIdentifier(name)->string));
 }
 
 static void emitConstant(const Value value) {
-    const bool result = writeConstant(currentChunk(), value, parser.previous.line);
-    if (!result) error("Too many constants in one chunk.");
+    emitIndex(OP_CONSTANT, makeConstant(value), parser.previous.line);
 }
 
 static void emitClosure(const ObjFunction *closure) {
@@ -293,21 +484,57 @@ static void emitClosure(const ObjFunction *closure) {
     if (!result) error("Too many constants in one chunk.");
 }
 
-static void emitIndex(const OpCode code, const int index, const int line) {
-    const bool result = writeIndex(code, currentChunk(), index, line);
-    if (!result) error("Too many identifier in one chunk.");
+static void markWideJumps() {
+    parser.jumpOverflow = true;
+    for (int i = 0; i < wideFunctions.count; i++) {
+        if (wideFunctions.sources[i] == current->source) return;
+    }
+
+    if (wideFunctions.count == wideFunctions.capacity) {
+        const int oldCapacity = wideFunctions.capacity;
+        wideFunctions.capacity = GROW_CAPACITY(oldCapacity);
+        wideFunctions.sources = GROW_ARRAY(const char *, wideFunctions.sources, oldCapacity, wideFunctions.capacity);
+    }
+    wideFunctions.sources[wideFunctions.count++] = current->source;
 }
 
 static void patchJump(const int offset) {
-    // -2 to adjust for the bytecode for the jump offset itself.
-    const int jump = currentChunk()->count - offset - 2;
+    // Adjust for the bytecode for the jump offset itself.
+    const int jump = currentChunk()->count - offset - jumpSize();
 
-    if (jump > UINT16_MAX) {
-        error("Too much code to jump over.");
+    if (current->wideJumps) {
+        if (jump > UINT24_MAX) {
+            error("Too much code to jump over.");
+        }
+        currentChunk()->code[offset] = (jump >> 16) & 0xff;
+        currentChunk()->code[offset + 1] = (jump >> 8) & 0xff;
+        currentChunk()->code[offset + 2] = jump & 0xff;
+    } else {
+        // The code is thrown away, the function gets wide jumps when the script compiles again.
+        if (jump > UINT16_MAX) markWideJumps();
+        currentChunk()->code[offset] = (jump >> 8) & 0xff;
+        currentChunk()->code[offset + 1] = jump & 0xff;
     }
+}
 
-    currentChunk()->code[offset] = (jump >> 8) & 0xff;
-    currentChunk()->code[offset + 1] = jump & 0xff;
+static void removeLastInstruction(const int offset) {
+    Chunk *chunk = currentChunk();
+    chunk->count = offset;
+    while (chunk->lineCount > 0 && chunk->lines[chunk->lineCount - 1].offset >= offset) {
+        chunk->lineCount--;
+    }
+}
+
+// Grows the locals as needed, the frame is sized for them and the temporaries in endCompiler.
+static Local *pushLocal() {
+    if (current->localCount == current->localCapacity) {
+        const int oldCapacity = current->localCapacity;
+        current->localCapacity = GROW_CAPACITY(oldCapacity);
+        current->locals = GROW_ARRAY(Local, current->locals, oldCapacity, current->localCapacity);
+    }
+
+    current->localCount++;
+    return &current->locals[current->localCount - 1];
 }
 
 static void initCompiler(Compiler *compiler, const FunctionType type, ObjString *name) {
@@ -316,20 +543,35 @@ static void initCompiler(Compiler *compiler, const FunctionType type, ObjString
     compiler->type = type;
     compiler->anonymousFunctionCount = 0;
 
-    compiler->localCapacity = 1;
+    compiler->locals = NULL;
+    compiler->localCapacity = 0;
     compiler->localCount = 0;
+    compiler->upvalues = NULL;
+    compiler->upvalueCapacity = 0;
     compiler->scopeDepth = 0;
 
+    compiler->source = parser.current.start;
+    compiler->wideJumps = false;
+    for (int i = 0; i < wideFunctions.count; i++) {
+        if (wideFunctions.sources[i] == compiler->source) compiler->wideJumps = true;
+    }
+
     compiler->controlFlowTop = -1;
+    compiler->lastCall = -1;
+    initTable(&compiler->constants);
 
+    // The name isn't reachable from anything yet, allocating the function could collect it.
+    if (name != NULL) push(OBJ_VAL(name));
     compiler->function = newFunction();
+    if (name != NULL) pop();
     current = compiler;
     current->function->name = name;
 
-    Local *local = &current->locals[current->localCount++];
+    Local *local = pushLocal();
     local->depth = 0;
     local->immutable = true;
     local->isCaptured = false;
+    local->hasValue = true;
 
     if (type == TYPE_METHOD || type == TYPE_INITIALIZER) {
         local->name.start = "this";
@@ -343,9 +585,21 @@ static void initCompiler(Compiler *compiler, const FunctionType type, ObjString
 static ObjFunction *endCompiler() {
     emitReturn();
     ObjFunction *function = current->function;
+    // Sized from the finished code, so inlined bodies are counted too.
+    if (!parser.hadError && !parser.jumpOverflow) {
+        const int depth = chunkStackDepth(currentChunk(), function->arity, NULL);
+        if (depth == -1) {
+            error("Stack depth of the function doesn't add up.");
+        } else {
+            function->stackSlots = depth + FRAME_EXTRA_SLOTS;
+        }
+    }
+    freeTable(&current->constants);
+    // The upvalues are still needed to emit the closure, function() frees them.
+    FREE_ARRAY(Local, current->locals, current->localCapacity);
 
 #ifdef DEBUG_PRINT_CODE
-    if (!parser.hadError) {
+    if (!parser.hadError && !parser.jumpOverflow) {
         disassembleChunk(currentChunk(), function->name != NULL
                                              ? function->name->chars
                                              : "<script>");
@@ -357,7 +611,7 @@ static ObjFunction *endCompiler() {
 }
 
 static void beginScope() {
-    if (current->scopeDepth + 1 >= STACK_MAX) {
+    if (current->scopeDepth + 1 >= MAX_SCOPE_DEPTH) {
         error("Too many scopes.");
     }
 
@@ -411,23 +665,38 @@ static void exitControlFlow() {
     }
 }
 
+// Jumps to the end of ctx, patched when it exits.
+static void emitBreakJump(ControlFlowContext *ctx) {
+    const int offset = emitJump(OP_JUMP);
+    JumpPatch *patch = malloc(sizeof(JumpPatch));
+    patch->jumpOffset = offset;
+    patch->next = ctx->breakPatchHead;
+    ctx->breakPatchHead = patch;
+}
+
 static void expression();
 
 static void statement();
 
 static void declaration();
 
-static void function(FunctionType type, ObjString *name);
+static ObjFunction *function(FunctionType type, ObjString *name);
 
 static ParseRule *getRule(TokenType type);
 
 static void parsePrecedence(Precedence precedence);
 
+static void namedVariable(Token name, bool canAssign);
+
 static int identifierConstant(const Token *name, const bool isAssignment, const bool immutable) {
-    const ObjString *nameStr = copyString(name->start, name->length);
+    Identifier *identifier = cachedIdentifier(name);
+    if (identifier->global != -1) {
+        return identifier->global;
+    }
 
     int index;
-    if (lookUpGlobal(&vm.globals, nameStr, &index)) {
+    if (lookUpGlobal(&vm.globals, identifier->string, &index)) {
+        identifier->global = index;
         return index;
     }
 
@@ -435,7 +704,8 @@ static int identifierConstant(const Token *name, const bool isAssignment, const
         errorAt(name, "Use of undeclared variable.");
     }
 
-    return declareGlobal(&vm.globals, nameStr, immutable);
+    identifier->global = declareGlobal(&vm.globals, identifier->string, immutable);
+    return identifier->global;
 }
 
 static bool identifiersEqual(const Token *a, const Token *b) {
@@ -456,8 +726,9 @@ static int resolveLocal(const Compiler *compiler, const Token *name) {
     return -1;
 }
 
-static uint8_t addUpvalue(Compiler *compiler, const int index, const bool isLocal) {
-    const int upvalueCount = compiler->function->upvalueCount;
+static int addUpvalue(Compiler *compiler, const int index, const bool isLocal, const bool byValue) {
+    ObjFunction *function = compiler->function;
+    const int upvalueCount = function->upvalueCount + function->capturedCount;
 
     for (int i = 0; i < upvalueCount; ++i) {
         const Upvalue *upvalue = &compiler->upvalues[i];
@@ -466,14 +737,22 @@ static uint8_t addUpvalue(Compiler *compiler, const int index, const bool isLoca
         }
     }
 
-    if (upvalueCount == UINT8_COUNT) {
+    if (upvalueCount > UINT24_MAX) {
         error("Too many closure variables in function.");
         return 0;
     }
 
+    if (upvalueCount == compiler->upvalueCapacity) {
+        const int oldCapacity = compiler->upvalueCapacity;
+        compiler->upvalueCapacity = GROW_CAPACITY(oldCapacity);
+        compiler->upvalues = GROW_ARRAY(Upvalue, compiler->upvalues, oldCapacity, compiler->upvalueCapacity);
+    }
+
     compiler->upvalues[upvalueCount].isLocal = isLocal;
     compiler->upvalues[upvalueCount].index = index;
-    return compiler->function->upvalueCount++;
+    compiler->upvalues[upvalueCount].byValue = byValue;
+    compiler->upvalues[upvalueCount].slot = byValue ? function->capturedCount++ : function->upvalueCount++;
+    return upvalueCount;
 }
 
 static int resolveUpvalue(Compiler *compiler, const Token *name) {
@@ -482,29 +761,32 @@ static int resolveUpvalue(Compiler *compiler, const Token *name) {
 
     const int local = resolveLocal(compiler->enclosing, name);
     if (local != -1) {
-        compiler->enclosing->locals[local].isCaptured = true;
-        return addUpvalue(compiler, local, true);
+        Local *captured = &compiler->enclosing->locals[local];
+        const bool byValue = captured->immutable && captured->hasValue;
+        if (!byValue) captured->isCaptured = true;
+        return addUpvalue(compiler, local, true, byValue);
     }
 
     const int upvalue = resolveUpvalue(compiler->enclosing, name);
     if (upvalue != -1) {
-        return addUpvalue(compiler, (uint8_t) upvalue, false);
+        return addUpvalue(compiler, upvalue, false, compiler->enclosing->upvalues[upvalue].byValue);
     }
 
     return -1;
 }
 
 static void addLocal(const Token name, const bool immutable) {
-    if (current->localCount + 1 > UINT8_COUNT) {
+    if (current->localCount > UINT24_MAX) {
         error("Too many local variables in function");
         return;
     }
 
-    Local *local = &current->locals[current->localCount++];
+    Local *local = pushLocal();
     local->name = name;
     local->depth = -1;
     local->immutable = immutable;
     local->isCaptured = false;
+    local->hasValue = true;
 }
 
 static void declareVariable(const bool immutable) {
@@ -657,6 +939,81 @@ static void anonymousFunction(bool _) {
     function(TYPE_ANONYMOUS_FUNCTION, debugName);
 }
 
+/*
+ * Switches start with an OP_SWITCH that jumps straight to the case for the subject. The table
+ * holds the cases up to the first one that isn't a number or string literal, those cases need
+ * no code of their own. The cases from there on are compared one by one, which is where the
+ * table sends every other subject. That way the first case that matches still wins.
+ */
+static ObjJumpTable *startJumpTable() {
+    ObjJumpTable *table = newJumpTable();
+    emitIndex(OP_SWITCH, makeConstant(OBJ_VAL(table)), parser.previous.line);
+    return table;
+}
+
+// Whether the code from start on only loads a number or string constant.
+static bool isConstantLoad(const int start, Value *value) {
+    const Chunk *chunk = currentChunk();
+    const uint8_t *code = chunk->code + start;
+    const int length = chunk->count - start;
+
+    int index;
+    if (length == 1) {
+        switch (code[0]) {
+            case OP_CONSTANT_M1: *value = NUMBER_VAL(-1); return true;
+            case OP_CONSTANT_0: *value = NUMBER_VAL(0); return true;
+            case OP_CONSTANT_1: *value = NUMBER_VAL(1); return true;
+            case OP_CONSTANT_2: *value = NUMBER_VAL(2); return true;
+            default: return false;
+        }
+    } else if (length == 2 && code[0] == OP_CONSTANT) {
+        index = code[1];
+    } else if (length == 5 && code[0] == OP_WIDE && code[1] == OP_CONSTANT) {
+        index = code[2] << 16 | code[3] << 8 | code[4];
+    } else {
+        return false;
+    }
+
+    *value = chunk->constants.values[index];
+    return IS_NUMBER(*value) || IS_STRING(*value);
+}
+
+// Sends the subjects without a case in the table to the code that follows.
+static void closeJumpTable(ObjJumpTable *table, bool *tableOpen) {
+    if (!*tableOpen) return;
+    table->missTarget = currentChunk()->count;
+    *tableOpen = false;
+}
+
+/*
+ * Compiles the value of a case. While the table is open a constant case only becomes an entry
+ * and -1 is returned. Otherwise the value is left on the stack and compared with the subject,
+ * the returned jump is taken when they differ.
+ */
+static int caseCondition(ObjJumpTable *table, bool *tableOpen) {
+    const int start = currentChunk()->count;
+    expression();
+    consume(TOKEN_COLON, "Expect ':' after condition.");
+
+    Value value;
+    if (*tableOpen && isConstantLoad(start, &value)) {
+        removeLastInstruction(start);
+
+        // An earlier case with the same value matches first.
+        Value existing;
+        if (!tableGet(&table->targets, value, &existing)) {
+            tableSet(&table->targets, value, NUMBER_VAL(start));
+        }
+        return -1;
+    }
+
+    if (*tableOpen) {
+        table->missTarget = start;
+        *tableOpen = false;
+    }
+    return emitJump(OP_JUMP_IF_NOT_EQUAL);
+}
+
 static void switchExpression(bool _) {
     consume(TOKEN_LEFT_PAREN, "Expect '(' after 'switch'.");
     expression();
@@ -664,27 +1021,23 @@ static void switchExpression(bool _) {
     consume(TOKEN_LEFT_BRACE, "Expect '{' for switch body.");
 
     ControlFlowContext *ctx = enterControlFlow(FLOW_SWITCH_EXPRESSION);
+    ObjJumpTable *table = startJumpTable();
 
     int caseExit = -1;
+    bool tableOpen = true;
     while (match(TOKEN_CASE)) {
         if (caseExit != -1) {
             patchJump(caseExit);
             emitByte(OP_POP);
         }
 
-        expression();
-        consume(TOKEN_COLON, "Expect ':' after condition.");
-
-        caseExit = emitJump(OP_JUMP_IF_NOT_EQUAL);
-        emitPopN(2);
+        caseExit = caseCondition(table, &tableOpen);
+        // The subject and the case value if it was compared, the value of the case replaces them.
+        emitPop(caseExit == -1 ? 1 : 2);
         expression();
         consume(TOKEN_COMMA, "Expect ',' after case expression.");
 
-        const int offset = emitJump(OP_JUMP);
-        JumpPatch *patch = malloc(sizeof(JumpPatch));
-        patch->jumpOffset = offset;
-        patch->next = ctx->breakPatchHead;
-        ctx->breakPatchHead = patch;
+        emitBreakJump(ctx);
     }
 
     if (match(TOKEN_EOF)) {
@@ -694,21 +1047,27 @@ static void switchExpression(bool _) {
 
     if (caseExit != -1) {
         patchJump(caseExit);
-        emitPopN(2);
+        emitByte(OP_POP);
     }
+    closeJumpTable(table, &tableOpen);
+    emitByte(OP_POP);
 
     if (match(TOKEN_DEFAULT)) {
         consume(TOKEN_COLON, "Expect ':' after 'default'.");
         expression();
         match(TOKEN_COMMA);
+    } else {
+        emitByte(OP_NIL);
     }
 
     consume(TOKEN_RIGHT_BRACE, "Expect closing '}' after switch body.");
     exitControlFlow();
+    finishJumpTable(table);
 }
 
 static void call(bool _) {
     const uint8_t argCount = argumentList();
+    current->lastCall = currentChunk()->count;
     emitBytes(OP_CALL, argCount);
 }
 
@@ -719,13 +1078,13 @@ static void dot(const bool canAssign) {
 
     if (canAssign && match(TOKEN_EQUAL)) {
         expression();
-        emitBytes(OP_SET_PROPERTY, name);
+        emitIndex(OP_SET_PROPERTY, name, nameToken->line);
     } else if (match(TOKEN_LEFT_PAREN)) {
         const uint8_t argCount = argumentList();
         emitIndex(OP_INVOKE, name, nameToken->line);
         emitByte(argCount);
     } else {
-        emitBytes(OP_GET_PROPERTY, name);
+        emitIndex(OP_GET_PROPERTY, name, nameToken->line);
     }
 }
 
@@ -750,8 +1109,17 @@ static void grouping(bool _) {
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
 }
 
+// The token isn't terminated, a mapped source file can end right after its last digit.
 static void number(bool _) {
-    const double value = strtod(parser.previous.start, NULL);
+    char buffer[64];
+    const int length = parser.previous.length;
+    char *digits = length < (int) sizeof(buffer) ? buffer : malloc(length + 1);
+    if (digits == NULL) exit(1);
+    memcpy(digits, parser.previous.start, length);
+    digits[length] = '\0';
+    const double value = strtod(digits, NULL);
+    if (digits != buffer) free(digits);
+
     if (value == -1) {
         emitByte(OP_CONSTANT_M1);
     } else if (value == 0) {
@@ -781,32 +1149,251 @@ static void postIncrementVariable(const int index, const BindingKind kind, const
     emitByte(OP_POP);
 }
 
+// Scans a list of single tokens up to the ')' that closes it, -1 if it is anything else.
+static int scanTokenList(Token *tokens, bool (*accept)(const Token *token)) {
+    Token token = scanToken();
+    if (token.type == TOKEN_RIGHT_PAREN) return 0;
+
+    for (int count = 0; count < INLINE_MAX_PARAMS && accept(&token);) {
+        tokens[count++] = token;
+        token = scanToken();
+        if (token.type == TOKEN_RIGHT_PAREN) return count;
+        if (token.type != TOKEN_COMMA) return -1;
+        token = scanToken();
+    }
+    return -1;
+}
+
+static bool isInitializedLocal(const Token *name) {
+    for (int i = current->localCount - 1; i >= 0; i--) {
+        if (identifiersEqual(name, &current->locals[i].name)) return current->locals[i].depth != -1;
+    }
+    return false;
+}
+
+// Reading the argument can't fail and can't change anything.
+static bool isInlinableArgument(const Token *token) {
+    switch (token->type) {
+        case TOKEN_NUMBER:
+        case TOKEN_STRING:
+        case TOKEN_TRUE:
+        case TOKEN_FALSE:
+        case TOKEN_NIL:
+            return true;
+        case TOKEN_IDENTIFIER:
+        case TOKEN_THIS:
+            return isInitializedLocal(token);
+        default:
+            return false;
+    }
+}
+
+#ifndef NO_INLINE_CALLS
+static bool isParameter(const Token *token) {
+    return token->type == TOKEN_IDENTIFIER;
+}
+
+static bool isInlinableToken(const TokenType type, const TokenType previous) {
+    switch (type) {
+        case TOKEN_LEFT_PAREN:
+            // Only as a grouping, a call could run code that changes an argument.
+            return previous != TOKEN_IDENTIFIER && previous != TOKEN_RIGHT_PAREN && previous != TOKEN_STRING &&
+                   previous != TOKEN_NUMBER && previous != TOKEN_TRUE && previous != TOKEN_FALSE &&
+                   previous != TOKEN_NIL;
+        case TOKEN_RIGHT_PAREN:
+        case TOKEN_DOT:
+        case TOKEN_QUESTIONMARK:
+        case TOKEN_COLON:
+        case TOKEN_PERCENT:
+        case TOKEN_SLASH:
+        case TOKEN_STAR:
+        case TOKEN_VERTICAL_BAR:
+        case TOKEN_AND_OPERATOR:
+        case TOKEN_CARET:
+        case TOKEN_MINUS:
+        case TOKEN_PLUS:
+        case TOKEN_BANG:
+        case TOKEN_BANG_EQUAL:
+        case TOKEN_EQUAL_EQUAL:
+        case TOKEN_GREATER:
+        case TOKEN_GREATER_GREATER:
+        case TOKEN_GREATER_EQUAL:
+        case TOKEN_LESS:
+        case TOKEN_LESS_LESS:
+        case TOKEN_LESS_EQUAL:
+        case TOKEN_IDENTIFIER:
+        case TOKEN_STRING:
+        case TOKEN_INTERPOLATION:
+        case TOKEN_NUMBER:
+        case TOKEN_AND:
+        case TOKEN_OR:
+        case TOKEN_TRUE:
+        case TOKEN_FALSE:
+        case TOKEN_NIL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+ * Scans ahead over the parameters and body of the function declared at the current token,
+ * fills in template if the body is `{ return <expression>; }` and the expression can be inlined.
+ */
+static bool scanInlineTemplate(InlineTemplate *template) {
+    const Scanner scanned = saveScanner();
+    template->arity = scanTokenList(template->params, isParameter);
+    bool inlinable = template->arity != -1 && scanToken().type == TOKEN_LEFT_BRACE &&
+                     scanToken().type == TOKEN_RETURN;
+
+    if (inlinable) {
+        template->body = saveScanner();
+        inlinable = false;
+        TokenType previous = TOKEN_RETURN;
+        for (int count = 0; count <= INLINE_MAX_TOKENS; count++) {
+            const Token token = scanToken();
+            if (token.type == TOKEN_SEMICOLON) {
+                inlinable = count > 0 && scanToken().type == TOKEN_RIGHT_BRACE;
+                break;
+            }
+            if (!isInlinableToken(token.type, previous)) break;
+            previous = token.type;
+        }
+    }
+
+    restoreScanner(scanned);
+    return inlinable;
+}
+#endif // NO_INLINE_CALLS
+
+// A later declaration of the same name replaces the template, or takes it away if it can't be inlined.
+static void setInlineTemplate(const Token *name, const InlineTemplate *template) {
+    int index = -1;
+    if (template != NULL) {
+        if (inlineTemplates.count == inlineTemplates.capacity) {
+            const int oldCapacity = inlineTemplates.capacity;
+            inlineTemplates.capacity = GROW_CAPACITY(oldCapacity);
+            inlineTemplates.entries = GROW_ARRAY(InlineTemplate, inlineTemplates.entries, oldCapacity,
+                                                 inlineTemplates.capacity);
+        }
+        index = inlineTemplates.count++;
+        inlineTemplates.entries[index] = *template;
+    }
+    cachedIdentifier(name)->inlineTemplate = index;
+}
+
+// Compiles the argument a parameter of the inlined call was given, false if name isn't a parameter.
+static bool inlineArgument(const Token *name) {
+    const InlineExpansion *expansion = inlining;
+    for (int i = 0; i < expansion->template->arity; i++) {
+        if (!identifiersEqual(name, &expansion->template->params[i])) continue;
+
+        // Arguments are names and literals of the caller, on the line of the parameter they replace.
+        Token argument = expansion->arguments[i];
+        argument.line = name->line;
+        const Token previous = parser.previous;
+        inlining = NULL;
+        parser.previous = argument;
+        if (argument.type == TOKEN_IDENTIFIER || argument.type == TOKEN_THIS) {
+            namedVariable(argument, false);
+        } else {
+            getRule(argument.type)->prefix(false);
+        }
+        parser.previous = previous;
+        inlining = expansion;
+        return true;
+    }
+    return false;
+}
+
+// The offset is always small, the body it jumps over is a handful of tokens.
+static void patchInlineGuard(const int offset, const bool wide) {
+    const int jump = currentChunk()->count - offset - (wide ? 3 : 2);
+    uint8_t *code = currentChunk()->code + offset;
+    if (wide) *code++ = (jump >> 16) & 0xff;
+    *code++ = (jump >> 8) & 0xff;
+    *code = jump & 0xff;
+}
+
+/*
+ * Called with the callee on the stack and the current token on the '(' of the call. The guard
+ * runs the inlined expression if the callee is still the function it came from, and the normal
+ * call otherwise. Stack traces show the inlined function through the chunk's inline ranges.
+ */
+static bool inlineCall(const Token *name) {
+    const int index = cachedIdentifier(name)->inlineTemplate;
+    if (inlining != NULL || index == -1) return false;
+
+    InlineExpansion expansion;
+    expansion.template = &inlineTemplates.entries[index];
+    const Scanner scanned = saveScanner();
+    const int argCount = scanTokenList(expansion.arguments, isInlinableArgument);
+    restoreScanner(scanned);
+    if (argCount != expansion.template->arity) return false;
+
+    const int function = makeConstant(OBJ_VAL(expansion.template->function));
+    const bool wide = function > UINT8_MAX;
+    emitIndex(OP_INLINE_GUARD, function, name->line);
+    const int guard = currentChunk()->count;
+    emitBytes(0xff, 0xff);
+    if (wide) emitByte(0xff);
+
+    // The expression is scanned again from the function body, with its lines.
+    const Token callCurrent = parser.current;
+    const Token callPrevious = parser.previous;
+    restoreScanner(expansion.template->body);
+    inlining = &expansion;
+    advance();
+    const int start = currentChunk()->count;
+    expression();
+    addInlineRange(currentChunk(), start, currentChunk()->count, function, name->line);
+    inlining = NULL;
+    restoreScanner(scanned);
+    parser.current = callCurrent;
+    parser.previous = callPrevious;
+
+    const int endJump = emitJump(OP_JUMP);
+    patchInlineGuard(guard, wide);
+    advance();
+    call(false);
+    patchJump(endJump);
+    return true;
+}
+
 static void namedVariable(const Token name, const bool canAssign) {
-#define SELF_ASSIGN(op)                         \
-    do                                          \
-    {                                           \
-        if (errorIfImmutable(&name, kind, arg)) \
-            return;                             \
-        advance();                              \
-        expression();                           \
-        emitIndex(getOp, arg, name.line);       \
-        emitByte(op);                           \
-        emitIndex(setOp, arg, name.line);       \
+#define SELF_ASSIGN(op)                             \
+    do                                              \
+    {                                               \
+        if (errorIfImmutable(&name, kind, binding)) \
+            return;                                 \
+        advance();                                  \
+        expression();                               \
+        emitIndex(getOp, arg, name.line);           \
+        emitByte(op);                               \
+        emitIndex(setOp, arg, name.line);           \
     } while (false);
 
+    if (inlining != NULL && inlineArgument(&name)) return;
+
     uint8_t getOp, setOp;
     BindingKind kind;
-    int arg = resolveLocal(current, &name);
+    // Any other name in an inlined expression is a global, whatever the caller declared.
+    int arg = inlining == NULL ? resolveLocal(current, &name) : -1;
+    // What errorIfImmutable looks at, only differs from the operand for upvalues.
+    int binding = arg;
     if (arg != -1) {
         getOp = OP_GET_LOCAL;
         setOp = OP_SET_LOCAL;
         kind = BINDING_LOCAL;
-    } else if ((arg = resolveUpvalue(current, &name)) != -1) {
-        getOp = OP_GET_UPVALUE;
+    } else if (inlining == NULL && (arg = resolveUpvalue(current, &name)) != -1) {
+        getOp = current->upvalues[arg].byValue ? OP_GET_CAPTURED : OP_GET_UPVALUE;
         setOp = OP_SET_UPVALUE;
         kind = BINDING_UPVALUE;
+        binding = arg;
+        arg = current->upvalues[arg].slot;
     } else {
         arg = identifierConstant(&name, false, false);
+        binding = arg;
         getOp = OP_GET_GLOBAL;
         setOp = OP_SET_GLOBAL;
         kind = BINDING_GLOBAL;
@@ -815,7 +1402,7 @@ static void namedVariable(const Token name, const bool canAssign) {
     if (canAssign) {
         switch (parser.current.type) {
             case TOKEN_EQUAL: {
-                if (errorIfImmutable(&name, kind, arg))
+                if (errorIfImmutable(&name, kind, binding))
                     return;
                 advance();
                 expression();
@@ -845,8 +1432,10 @@ static void namedVariable(const Token name, const bool canAssign) {
 
     emitIndex(getOp, arg, name.line);
 
+    if (kind == BINDING_GLOBAL && check(TOKEN_LEFT_PAREN) && inlineCall(&name)) return;
+
     if (match(TOKEN_PLUS_PLUS) || match(TOKEN_MINUS_MINUS)) {
-        if (errorIfImmutable(&name, kind, arg))
+        if (errorIfImmutable(&name, kind, binding))
             return;
         const bool decrement = parser.previous.type == TOKEN_MINUS_MINUS;
         postIncrementVariable(arg, kind, decrement, name.line);
@@ -1075,7 +1664,7 @@ static void block() {
     consume(TOKEN_RIGHT_BRACE, "Expected '}' after block.");
 }
 
-static void function(const FunctionType type, ObjString *name) {
+static ObjFunction *function(const FunctionType type, ObjString *name) {
     Compiler compiler;
     initCompiler(&compiler, type, name);
     beginScope();
@@ -1106,13 +1695,23 @@ static void function(const FunctionType type, ObjString *name) {
     consume(TOKEN_LEFT_BRACE, "Expect '{' before function body.");
     block();
 
-    const ObjFunction *function = endCompiler();
+    ObjFunction *function = endCompiler();
     emitClosure(function);
 
-    for (int i = 0; i < function->upvalueCount; ++i) {
-        emitByte(compiler.upvalues[i].isLocal ? 1 : 0);
-        emitByte(compiler.upvalues[i].index);
+    for (int i = 0; i < function->upvalueCount + function->capturedCount; ++i) {
+        const Upvalue *upvalue = &compiler.upvalues[i];
+        const int index = upvalue->isLocal ? upvalue->index : current->upvalues[upvalue->index].slot;
+        const bool wide = index > UINT8_MAX;
+        emitByte((upvalue->isLocal ? UPVALUE_LOCAL : 0) | (upvalue->byValue ? UPVALUE_BY_VALUE : 0) |
+                 (wide ? UPVALUE_WIDE : 0));
+        if (wide) {
+            emitByte((index >> 16) & 0xff);
+            emitByte((index >> 8) & 0xff);
+        }
+        emitByte(index & 0xff);
     }
+    FREE_ARRAY(Upvalue, compiler.upvalues, compiler.upvalueCapacity);
+    return function;
 }
 
 static void method() {
@@ -1120,7 +1719,7 @@ static void method() {
     const Token *name = &parser.previous;
     const int constant = makeIdentifier(name);
 
-    ObjString *nameObj = copyString(name->start, name->length);
+    ObjString *nameObj = cachedIdentifier(name)->string;
 
     FunctionType type = TYPE_METHOD;
     if (parser.previous.length == 4 && memcmp(parser.previous.start, "init", 4) == 0) {
@@ -1184,9 +1783,23 @@ static void classDeclaration() {
 static void funDeclaration() {
     const int index = parseVariable("Expect function name.", true);
     const Token *name = &parser.previous;
+    const Token declared = *name;
     makeInitialized();
-    ObjString *nameObj = copyString(name->start, name->length);
-    function(TYPE_FUNCTION, nameObj);
+    ObjString *nameObj = cachedIdentifier(name)->string;
+
+    // Recursive references inside the body have to see the closure once it exists.
+    const bool isLocal = current->scopeDepth > 0;
+    if (isLocal) current->locals[current->localCount - 1].hasValue = false;
+
+    InlineTemplate template;
+    bool inlinable = false;
+#ifndef NO_INLINE_CALLS
+    inlinable = current->type == TYPE_SCRIPT && !isLocal && scanInlineTemplate(&template);
+#endif
+    template.function = function(TYPE_FUNCTION, nameObj);
+    if (!isLocal) setInlineTemplate(&declared, inlinable ? &template : NULL);
+    if (isLocal) current->locals[current->localCount - 1].hasValue = true;
+
     defineVariable(index, name->line);
 }
 
@@ -1404,30 +2017,37 @@ static void repeatStatement() {
 
 static void switchStatement() {
     consume(TOKEN_LEFT_PAREN, "Expect '(' after 'switch'.");
+    beginScope();
     expression();
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
+    // The subject lives in a hidden local, so break and continue pop everything above it.
+    addLocal(syntheticToken(""), true);
+    makeInitialized();
+
     consume(TOKEN_LEFT_BRACE, "Expect '{' for switch body.");
 
-    beginScope();
-    enterControlFlow(FLOW_SWITCH);
+    ControlFlowContext *ctx = enterControlFlow(FLOW_SWITCH);
+    ObjJumpTable *table = startJumpTable();
 
     int caseExit = -1;
+    bool tableOpen = true;
     while (match(TOKEN_CASE)) {
         if (caseExit != -1) {
             patchJump(caseExit);
             emitByte(OP_POP);
         }
 
-        expression();
-        consume(TOKEN_COLON, "Expect ':' after condition.");
-
-        caseExit = emitJump(OP_JUMP_IF_NOT_EQUAL);
-        emitByte(OP_POP);
+        caseExit = caseCondition(table, &tableOpen);
+        if (caseExit != -1) emitByte(OP_POP);
 
+        // Every case has its own scope and leaves the switch at its end.
+        beginScope();
         while (!check(TOKEN_CASE) && !check(TOKEN_DEFAULT) && !check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
             statement();
         }
+        endScope();
+        emitBreakJump(ctx);
     }
 
     if (match(TOKEN_EOF)) {
@@ -1439,12 +2059,15 @@ static void switchStatement() {
         patchJump(caseExit);
         emitByte(OP_POP);
     }
+    closeJumpTable(table, &tableOpen);
 
     if (match(TOKEN_DEFAULT)) {
         consume(TOKEN_COLON, "Expect ':' after 'default'.");
+        beginScope();
         while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
             statement();
         }
+        endScope();
         if (match(TOKEN_EOF)) {
             error("Expect closing '}' after switch body.");
             return;
@@ -1453,7 +2076,7 @@ static void switchStatement() {
 
     consume(TOKEN_RIGHT_BRACE, "Expect closing '}' after switch body.");
     exitControlFlow();
-    emitByte(OP_POP);
+    finishJumpTable(table);
     endScope();
 }
 
@@ -1480,24 +2103,24 @@ static void continueStatement() {
 }
 
 static void breakStatement() {
-    ControlFlowContext *ctx = searchControlFlow(FLOW_LOOP);
-    if (ctx == NULL) {
-        ctx = searchControlFlow(FLOW_SWITCH);
-        if (ctx == NULL) {
-            error("Can't use 'break' outside of a loop or switch.");
-            return;
+    // Leaves whichever of the loops and switches around it is innermost.
+    ControlFlowContext *ctx = NULL;
+    for (int i = current->controlFlowTop; i >= 0; i--) {
+        const FlowKind kind = current->controlFlowStack[i].kind;
+        if (kind == FLOW_LOOP || kind == FLOW_SWITCH) {
+            ctx = &current->controlFlowStack[i];
+            break;
         }
     }
+    if (ctx == NULL) {
+        error("Can't use 'break' outside of a loop or switch.");
+        return;
+    }
 
     consume(TOKEN_SEMICOLON, "Expect ';' after 'break'.");
 
     emitPopTo(ctx->innermostScopeDepth);
-
-    const int offset = emitJump(OP_JUMP);
-    JumpPatch *patch = malloc(sizeof(JumpPatch));
-    patch->jumpOffset = offset;
-    patch->next = ctx->breakPatchHead;
-    ctx->breakPatchHead = patch;
+    emitBreakJump(ctx);
 }
 
 static void returnStatement() {
@@ -1514,6 +2137,11 @@ static void returnStatement() {
 
         expression();
         consume(TOKEN_SEMICOLON, "Expect ';' after return value.");
+
+        // Both have the same size, jumps that target the return still land on it.
+        if (current->lastCall != -1 && current->lastCall == currentChunk()->count - 2) {
+            currentChunk()->code[current->lastCall] = OP_TAIL_CALL;
+        }
         emitByte(OP_RETURN);
     }
 }
@@ -1589,28 +2217,71 @@ static void declaration() {
         synchronize();
 }
 
-ObjFunction *compile(const char *source) {
-    initScanner(source);
-    Compiler compiler;
-    initCompiler(&compiler, TYPE_SCRIPT, NULL);
-
+static ObjFunction *compilePass(const char *source, const size_t length) {
+    initScanner(source, length);
     parser.hadError = false;
     parser.panicMode = false;
+    parser.jumpOverflow = false;
+    parser.incomplete = false;
+    // Templates hold functions of the previous pass.
+    inlineTemplates.count = 0;
+    for (int i = 0; i < identifiers.capacity; i++) {
+        identifiers.entries[i].inlineTemplate = -1;
+    }
 
     advance();
 
+    Compiler compiler;
+    initCompiler(&compiler, TYPE_SCRIPT, NULL);
+
     while (!match(TOKEN_EOF)) {
         declaration();
     }
 
-    ObjFunction *function = endCompiler();
+    return endCompiler();
+}
+
+/*
+ * Jumps are emitted before their targets are known, so a function only learns it needs
+ * wide ones once a jump overflows. The script is then compiled again with wide jumps in
+ * every function that overflowed, all others keep the compact form.
+ */
+ObjFunction *compile(const char *source, const size_t length) {
+    ObjFunction *function = compilePass(source, length);
+    while (parser.jumpOverflow && !parser.hadError) {
+        function = compilePass(source, length);
+    }
+
+    freeIdentifiers();
+    FREE_ARRAY(const char *, wideFunctions.sources, wideFunctions.capacity);
+    wideFunctions.sources = NULL;
+    wideFunctions.count = 0;
+    wideFunctions.capacity = 0;
+    FREE_ARRAY(InlineTemplate, inlineTemplates.entries, inlineTemplates.capacity);
+    inlineTemplates.entries = NULL;
+    inlineTemplates.count = 0;
+    inlineTemplates.capacity = 0;
     return parser.hadError ? NULL : function;
 }
 
+ObjFunction *compileReplInput(const char *source, const size_t length, bool *incomplete) {
+    parser.allowIncomplete = true;
+    ObjFunction *function = compile(source, length);
+    parser.allowIncomplete = false;
+    *incomplete = parser.incomplete;
+    return function;
+}
+
 void markCompilerRoots() {
     Compiler *compiler = current;
     while (compiler != NULL) {
         markObject((Obj *) compiler->function);
         compiler = compiler->enclosing;
     }
+
+    for (int i = 0; i < identifiers.capacity; i++) {
+        if (identifiers.entries[i].start != NULL) {
+            markObject((Obj *) identifiers.entries[i].string);
+        }
+    }
 }
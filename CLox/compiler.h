@@ -7,7 +7,10 @@
 
 typedef enum { BINDING_LOCAL, BINDING_UPVALUE, BINDING_GLOBAL } BindingKind;
 
-ObjFunction *compile(const char *source);
+ObjFunction *compile(const char *source, size_t length);
+
+// Like compile, but source that ends in the middle of a declaration sets incomplete instead of reporting an error.
+ObjFunction *compileReplInput(const char *source, size_t length, bool *incomplete);
 
 void markCompilerRoots();
 
@@ -58,12 +58,30 @@ static int incrementInstructionU24(const char *name, const Chunk *chunk, const i
     return offset + 5;
 }
 
-static int jumpInstruction(const char *name, const int sign, const Chunk *chunk, const int offset) {
+static int jumpInstructionU16(const char *name, const int sign, const Chunk *chunk, const int offset) {
     const uint16_t jump = disassembleU16Constant(chunk, offset);
     printf("%-16s %4d -> %d\n", name, offset, offset + 3 + sign * jump);
     return offset + 3;
 }
 
+static int jumpInstructionU24(const char *name, const int sign, const Chunk *chunk, const int offset) {
+    const int jump = disassembleU24Constant(chunk, offset);
+    printf("%-16s %4d -> %d\n", name, offset, offset + 4 + sign * jump);
+    return offset + 4;
+}
+
+// The constant index and the jump offset are both u24 in the wide form.
+static int guardInstruction(const char *name, const bool wide, const Chunk *chunk, const int offset) {
+    const int constant = wide ? disassembleU24Constant(chunk, offset) : chunk->code[offset + 1];
+    const int operand = offset + (wide ? 4 : 2);
+    const int jump = wide ? disassembleU24Constant(chunk, operand - 1) : disassembleU16Constant(chunk, operand - 1);
+    const int next = operand + (wide ? 3 : 2);
+    printf("%-16s %4d '", name, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("' -> %d\n", next + jump);
+    return next;
+}
+
 int invokeInstructionU8(const char *name, const Chunk *chunk, const int offset) {
     const uint8_t constant = chunk->code[offset + 1];
     const uint8_t argCount = chunk->code[offset + 2];
@@ -95,6 +113,10 @@ int disassembleInstruction(const Chunk *chunk, int offset) {
         ? incrementInstructionU24(nameU24, chunk, offset) \
         : incrementInstructionU8(nameU8, chunk, offset);
 
+#define jumpInstruction(nameU16, nameU24, sign, chunk, offset) wideInstruction \
+        ? jumpInstructionU24(nameU24, sign, chunk, offset) \
+        : jumpInstructionU16(nameU16, sign, chunk, offset);
+
 #define invokeInstruction(nameU8, nameU24, chunk, offset) wideInstruction \
         ? invokeInstructionU24(nameU24, chunk, offset) \
         : invokeInstructionU8(nameU8, chunk, offset);
@@ -155,9 +177,11 @@ int disassembleInstruction(const Chunk *chunk, int offset) {
         case OP_SET_GLOBAL:
             return indexInstruction("OP_SET_GLOBAL", "OP_SET_GLOBAL.W", chunk, offset);
         case OP_GET_UPVALUE:
-            return indexInstructionU8("OP_GET_UPVALUE", chunk, offset);
+            return indexInstruction("OP_GET_UPVALUE", "OP_GET_UPVALUE.W", chunk, offset);
         case OP_SET_UPVALUE:
-            return indexInstructionU8("OP_SET_UPVALUE", chunk, offset);
+            return indexInstruction("OP_SET_UPVALUE", "OP_SET_UPVALUE.W", chunk, offset);
+        case OP_GET_CAPTURED:
+            return indexInstruction("OP_GET_CAPTURED", "OP_GET_CAPTURED.W", chunk, offset);
         case OP_GET_PROPERTY:
             return indexInstruction("OP_GET_PROPERTY", "OP_GET_PROPERTY.W", chunk, offset);
         case OP_SET_PROPERTY:
@@ -195,34 +219,47 @@ int disassembleInstruction(const Chunk *chunk, int offset) {
         case OP_NEGATE:
             return simpleInstruction("OP_NEGATE", offset);
         case OP_JUMP:
-            return jumpInstruction("OP_JUMP", 1, chunk, offset);
+            return jumpInstruction("OP_JUMP", "OP_JUMP.W", 1, chunk, offset);
         case OP_JUMP_IF_TRUE:
-            return jumpInstruction("OP_JUMP_IF_TRUE", 1, chunk, offset);
+            return jumpInstruction("OP_JUMP_IF_TRUE", "OP_JUMP_IF_TRUE.W", 1, chunk, offset);
         case OP_JUMP_IF_FALSE:
-            return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+            return jumpInstruction("OP_JUMP_IF_FALSE", "OP_JUMP_IF_FALSE.W", 1, chunk, offset);
         case OP_JUMP_IF_NOT_EQUAL:
-            return jumpInstruction("OP_JUMP_IF_NOT_EQUAL", 1, chunk, offset);
+            return jumpInstruction("OP_JUMP_IF_NOT_EQUAL", "OP_JUMP_IF_NOT_EQUAL.W", 1, chunk, offset);
+        case OP_SWITCH:
+            return constInstruction("OP_SWITCH", "OP_SWITCH.W", chunk, offset);
+        case OP_INLINE_GUARD:
+            return guardInstruction(wideInstruction ? "OP_INLINE_GUARD.W" : "OP_INLINE_GUARD", wideInstruction,
+                                    chunk, offset);
         case OP_LOOP:
-            return jumpInstruction("OP_LOOP", -1, chunk, offset);
+            return jumpInstruction("OP_LOOP", "OP_LOOP.W", -1, chunk, offset);
         case OP_LOOP_IF_FALSE:
-            return jumpInstruction("OP_LOOP_IF_FALSE", -1, chunk, offset);
+            return jumpInstruction("OP_LOOP_IF_FALSE", "OP_LOOP_IF_FALSE.W", -1, chunk, offset);
         case OP_JOIN_STR:
             return indexInstructionU8("OP_CALL", chunk, offset);
         case OP_PRINT:
             return simpleInstruction("OP_PRINT", offset);
         case OP_CALL:
             return indexInstructionU8("OP_CALL", chunk, offset);
+        case OP_TAIL_CALL:
+            return indexInstructionU8("OP_TAIL_CALL", chunk, offset);
         case OP_CLOSURE: {
             const int constant = wideInstruction ? disassembleU24Constant(chunk, offset) : chunk->code[offset + 1];
             offset += wideInstruction ? 4 : 2;
             printf("%-16s %4d \n", wideInstruction ? "OP_CLOSURE.W" : "OP_CLOSURE", constant);
 
             const ObjFunction *function = AS_FUNCTION(chunk->constants.values[constant]);
-            for (int i = 0; i < function->upvalueCount; ++i) {
-                const int isLocal = chunk->code[offset++];
-                const int index = chunk->code[offset++];
-                printf("%04d      |                     %s %d\n",
-                       offset - 2, isLocal ? "local" : "upvalue", index);
+            for (int i = 0; i < function->upvalueCount + function->capturedCount; ++i) {
+                const int start = offset;
+                const int flags = chunk->code[offset++];
+                int index = chunk->code[offset++];
+                if (flags & UPVALUE_WIDE) {
+                    index = index << 16 | chunk->code[offset] << 8 | chunk->code[offset + 1];
+                    offset += 2;
+                }
+                printf("%04d      |                     %s %d%s\n",
+                       start, flags & UPVALUE_LOCAL ? "local" : "upvalue", index,
+                       flags & UPVALUE_BY_VALUE ? " (value)" : "");
             }
             return offset;
         }
@@ -1,21 +1,21 @@
 ﻿#include "global.h"
 
 void initGlobals(Globals *globals) {
-    initTable(&globals->globalNames);
+    initStringTable(&globals->globalNames);
     globals->count = 0;
     globals->capacity = 0;
     globals->values = NULL;
 }
 
 void freeGlobals(Globals *globals) {
-    freeTable(&globals->globalNames);
+    freeStringTable(&globals->globalNames);
     FREE_ARRAY(Value, globals->values, globals->capacity);
     globals->count = 0;
     globals->capacity = 0;
     globals->values = NULL;
 }
 
-int declareGlobal(Globals *globals, const ObjString *name, const bool immutable) {
+int declareGlobal(Globals *globals, ObjString *name, const bool immutable) {
     const int newIndex = globals->count;
 
     if (globals->capacity < globals->count + 1) {
@@ -26,20 +26,21 @@ int declareGlobal(Globals *globals, const ObjString *name, const bool immutable)
 
     Global *global = &globals->values[globals->count++];
     global->value = UNDEFINED_VAL;
+    global->name = name;
     global->immutable = immutable;
 
-    tableSet(&globals->globalNames, OBJ_VAL(name), NUMBER_VAL((double)newIndex));
+    stringTableSet(&globals->globalNames, name, NUMBER_VAL((double)newIndex));
     return newIndex;
 }
 
-void defineGlobal(Globals *globals, const ObjString *name, const Value value, const bool immutable) {
+void defineGlobal(Globals *globals, ObjString *name, const Value value, const bool immutable) {
     const int index = declareGlobal(globals, name, immutable);
     globals->values[index].value = value;
 }
 
 bool lookUpGlobal(const Globals *globals, const ObjString *name, int *out) {
     Value index;
-    if (tableGet(&globals->globalNames, OBJ_VAL(name), &index)) {
+    if (stringTableGet(&globals->globalNames, name, &index)) {
         *out = AS_NUMBER(index);
         return true;
     }
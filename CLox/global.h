@@ -11,11 +11,12 @@
 
 typedef struct {
     Value value;
+    ObjString *name;
     bool immutable;
 } Global;
 
 typedef struct {
-    Table globalNames;
+    StringTable globalNames;
     int capacity;
     int count;
     Global *values;
@@ -25,9 +26,9 @@ void initGlobals(Globals *globals);
 
 void freeGlobals(Globals *globals);
 
-int declareGlobal(Globals *globals, const ObjString *name, bool immutable);
+int declareGlobal(Globals *globals, ObjString *name, bool immutable);
 
-void defineGlobal(Globals *globals, const ObjString *name, Value value, bool immutable);
+void defineGlobal(Globals *globals, ObjString *name, Value value, bool immutable);
 
 bool lookUpGlobal(const Globals *globals, const ObjString *name, int *out);
 
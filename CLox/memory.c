@@ -1,6 +1,7 @@
 #include "memory.h"
 #include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "object.h"
 #include "value.h"
@@ -23,7 +24,7 @@
  */
 void *reallocate(void *pointer, const size_t oldSize, const size_t newSize) {
     vm.bytesAllocated += newSize - oldSize;
-    if (newSize > oldSize) {
+    if (newSize > oldSize && !vm.collecting) {
 #ifdef DEBUG_STRESS_GC
         collectGarbage();
 #endif // DEBUG_STRESS_GC
@@ -92,17 +93,22 @@ static void blackenObject(Obj *object) {
         }
         case OBJ_CLASS: {
             ObjClass *klass = (ObjClass *) object;
-            markTable(&klass->methods);
+            markStringTable(&klass->methods);
             markObject((Obj *) klass->name);
             markObject((Obj *) klass->init);
+            markObject((Obj *) klass->superclass);
             break;
         }
         case OBJ_CLOSURE: {
-            const ObjClosure *closure = (ObjClosure *) object;
+            ObjClosure *closure = (ObjClosure *) object;
             markObject((Obj *) closure->function);
             for (int i = 0; i < closure->upvalueCount; i++) {
                 markObject((Obj *) closure->upvalues[i]);
             }
+            const Value *captured = closureCaptured(closure);
+            for (int i = 0; i < closure->capturedCount; i++) {
+                markValue(captured[i]);
+            }
             break;
         }
         case OBJ_FUNCTION: {
@@ -114,9 +120,12 @@ static void blackenObject(Obj *object) {
         case OBJ_INSTANCE: {
             ObjInstance *instance = (ObjInstance *) object;
             markObject((Obj *) instance->klass);
-            markTable(&instance->fields);
+            markStringTable(&instance->fields);
             break;
         }
+        case OBJ_JUMP_TABLE:
+            markTable(&((ObjJumpTable *) object)->targets);
+            break;
         case OBJ_UPVALUE: {
             markValue(((ObjUpvalue *) object)->closed);
             break;
@@ -132,6 +141,8 @@ static void freeObject(Obj *object) {
     printf("%p free type %d\n", (void *) object, objType(object));
 #endif // DEBUG_LOG_GC
 
+    if (hasIdentityHash(object)) removeIdentityHash(object);
+
     switch (objType(object)) {
         case OBj_BOUND_METHOD: {
             FREE(ObjBoundMethod, object);
@@ -139,14 +150,13 @@ static void freeObject(Obj *object) {
         }
         case OBJ_CLASS: {
             ObjClass *klass = (ObjClass *) object;
-            freeTable(&klass->methods);
+            freeStringTable(&klass->methods);
             FREE(ObjClass, object);
             break;
         }
         case OBJ_CLOSURE: {
             const ObjClosure *closure = (ObjClosure *) object;
-            FREE_ARRAY(ObjClosure *, closure->upvalues, closure->upvalueCount);
-            FREE(ObjClosure, object);
+            reallocate(object, closureSize(closure->upvalueCount, closure->capturedCount), 0);
             break;
         }
         case OBJ_FUNCTION: {
@@ -157,10 +167,17 @@ static void freeObject(Obj *object) {
         }
         case OBJ_INSTANCE: {
             ObjInstance *instance = (ObjInstance *) object;
-            freeTable(&instance->fields);
+            freeStringTable(&instance->fields);
             FREE(ObjInstance, object);
             break;
         }
+        case OBJ_JUMP_TABLE: {
+            ObjJumpTable *table = (ObjJumpTable *) object;
+            freeTable(&table->targets);
+            FREE_ARRAY(int, table->dense, table->denseCount);
+            FREE(ObjJumpTable, object);
+            break;
+        }
         case OBJ_NATIVE:
             FREE(ObjNative, object);
             break;
@@ -180,7 +197,7 @@ static void markRoots() {
         markValue(*slot);
     }
 
-    markTable(&vm.globals.globalNames);
+    markStringTable(&vm.globals.globalNames);
     for (int i = 0; i < vm.globals.count; i++) {
         markValue(vm.globals.values[i].value);
     }
@@ -189,14 +206,16 @@ static void markRoots() {
         markObject((Obj *) vm.frames[i].closure);
     }
 
-    ObjUpvalue *upvalue = vm.openUpvalues;
-    while (upvalue != NULL) {
-        markObject((Obj *) upvalue);
-        upvalue = upvalue->next;
+    for (int i = 0; i < vm.openUpvalueCount; i++) {
+        markObject((Obj *) vm.openUpvalues[i]);
     }
 
     markCompilerRoots();
     markValue(vm.initString);
+
+    for (int i = 0; i < UINT8_COUNT + 1; i++) {
+        markObject((Obj *) vm.shortStrings[i]);
+    }
 }
 
 static void traceReferences() {
@@ -235,6 +254,10 @@ void collectGarbage() {
     size_t before = vm.bytesAllocated;
 #endif // DEBUG_LOG_GC
 
+    vm.collecting = true;
+    memset(vm.boundMethods, 0, sizeof(vm.boundMethods));
+    memset(vm.methodCache, 0, sizeof(vm.methodCache));
+
     markRoots();
     traceReferences();
     tableRemoveWhiet(&vm.strings);
@@ -243,6 +266,10 @@ void collectGarbage() {
     vm.markValue = !vm.markValue;
     vm.nextGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;
 
+    // Done after nextGC is updated, shrinking the table allocates.
+    tableCompact(&vm.strings);
+    vm.collecting = false;
+
 #ifdef DEBUG_LOG_GC
     printf("-- gc end\n");
     printf("   collected %zu bytes (fromn %zu to %zu) next at %zu\n",
@@ -1,5 +1,6 @@
 ﻿#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "memory.h"
@@ -13,7 +14,7 @@
 
 static Obj *allocateObject(const size_t size, const ObjType type) {
     Obj *obj = reallocate(NULL, 0, size);
-    obj->header = (uint64_t) vm.objects | (uint64_t) vm.markValue << 48 | (uint64_t) type << 56;
+    obj->header = (uint64_t) vm.objects | (uint64_t) !vm.markValue << 48 | (uint64_t) type << 56;
     vm.objects = obj;
 
 #ifdef DEBUG_LOG_GC
@@ -25,7 +26,7 @@ static Obj *allocateObject(const size_t size, const ObjType type) {
 
 static Obj *allocateObjectUnlinked(const size_t size, const ObjType type) {
     Obj *obj = reallocate(NULL, 0, size);
-    obj->header = (uint64_t) NULL | (uint64_t) vm.markValue << 48 | (uint64_t) type << 56;
+    obj->header = (uint64_t) NULL | (uint64_t) !vm.markValue << 48 | (uint64_t) type << 56;
 
 #ifdef DEBUG_LOG_GC
     printf("%p allocate %zu for %d\n", (void *) obj, size, type);
@@ -52,20 +53,25 @@ ObjClass *newClass(ObjString *name) {
     klass->name = name;
     klass->init = NULL;
     klass->superInit = NULL;
-    initTable(&klass->methods);
+    klass->superclass = NULL;
+    initStringTable(&klass->methods);
+    klass->fieldCount = 0;
     return klass;
 }
 
 ObjClosure *newClosure(ObjFunction *function) {
-    ObjUpvalue **upvalues = ALLOCATE(ObjUpvalue*, function->upvalueCount);
-    for (int i = 0; i < function->upvalueCount; ++i) {
-        upvalues[i] = NULL;
-    }
-
-    ObjClosure *closure = ALLOCATE_OBJ(ObjClosure, OBJ_CLOSURE);
+    ObjClosure *closure = (ObjClosure *) allocateObject(
+        closureSize(function->upvalueCount, function->capturedCount), OBJ_CLOSURE);
     closure->function = function;
-    closure->upvalues = upvalues;
     closure->upvalueCount = function->upvalueCount;
+    closure->capturedCount = function->capturedCount;
+    for (int i = 0; i < function->upvalueCount; ++i) {
+        closure->upvalues[i] = NULL;
+    }
+    Value *captured = closureCaptured(closure);
+    for (int i = 0; i < function->capturedCount; ++i) {
+        captured[i] = NIL_VAL;
+    }
     return closure;
 }
 
@@ -73,21 +79,90 @@ ObjFunction *newFunction() {
     ObjFunction *function = ALLOCATE_OBJ(ObjFunction, OBJ_FUNCTION);
     function->arity = 0;
     function->upvalueCount = 0;
+    function->capturedCount = 0;
+    function->stackSlots = 0;
     function->name = NULL;
     initChunk(&function->chunk);
     return function;
 }
 
+// Instances used as maps can collect any number of fields, those are not worth presizing for.
+#define PRESIZED_FIELDS_MAX 32
+
 ObjInstance *newInstance(ObjClass *klass) {
+    // The fields go first, the instance is not reachable yet if their allocation collects.
+    StringTable fields;
+    initStringTableSized(&fields, klass->fieldCount < PRESIZED_FIELDS_MAX ? klass->fieldCount : PRESIZED_FIELDS_MAX);
     ObjInstance *instance = ALLOCATE_OBJ(ObjInstance, OBJ_INSTANCE);
     instance->klass = klass;
-    initTable(&instance->fields);
+    instance->fields = fields;
     return instance;
 }
 
-ObjNative *newNative(const NativeFn function) {
+ObjJumpTable *newJumpTable() {
+    ObjJumpTable *table = ALLOCATE_OBJ(ObjJumpTable, OBJ_JUMP_TABLE);
+    initTable(&table->targets);
+    table->missTarget = 0;
+    table->denseMin = 0;
+    table->denseCount = 0;
+    table->dense = NULL;
+    return table;
+}
+
+// Integer cases are only indexed when at least every other slot of the index holds one.
+#define DENSE_MIN_CASES 4
+#define DENSE_MAX_SPREAD 2
+
+static bool denseKey(const Value key, int *out) {
+    if (!IS_NUMBER(key)) return false;
+
+    const double number = AS_NUMBER(key);
+    if (number < -INT32_MAX / 2 || number > INT32_MAX / 2 || number != (int) number) return false;
+    *out = (int) number;
+    return true;
+}
+
+void finishJumpTable(ObjJumpTable *table) {
+    int count = 0;
+    int min = 0;
+    int max = 0;
+    int index = -1;
+    for (const Entry *entry = tableNextEntry(&table->targets, &index); entry != NULL;
+         entry = tableNextEntry(&table->targets, &index)) {
+        int number;
+        if (!denseKey(entry->key, &number)) continue;
+        if (count == 0 || number < min) min = number;
+        if (count == 0 || number > max) max = number;
+        count++;
+    }
+
+    if (count < DENSE_MIN_CASES || max - min + 1 > count * DENSE_MAX_SPREAD) return;
+
+    const int denseCount = max - min + 1;
+    int *dense = ALLOCATE(int, denseCount);
+    for (int i = 0; i < denseCount; i++) {
+        dense[i] = -1;
+    }
+
+    index = -1;
+    for (const Entry *entry = tableNextEntry(&table->targets, &index); entry != NULL;
+         entry = tableNextEntry(&table->targets, &index)) {
+        int number;
+        if (denseKey(entry->key, &number)) dense[number - min] = (int) AS_NUMBER(entry->value);
+    }
+
+    table->denseMin = min;
+    table->denseCount = denseCount;
+    table->dense = dense;
+}
+
+ObjNative *newNative(const NativeFn function, const char *name, const char *params) {
     ObjNative *native = ALLOCATE_OBJ(ObjNative, OBJ_NATIVE);
     native->function = function;
+    native->name = name;
+    native->params = params;
+    native->arity = params == NULL ? NATIVE_VARIADIC : (int) strlen(params);
+    native->typed = params != NULL && strspn(params, "a") != strlen(params);
     return native;
 }
 
@@ -112,7 +187,80 @@ uint32_t hashString(const char *key, const int length) {
     return hash;
 }
 
-ObjString *copyString(const char *chars, const int length) {
+// The address only places the entry in the side table, a moving collector would rehash it.
+static uint32_t identitySlot(const Obj *object, const int capacity) {
+    const uint64_t key = (uint64_t) (uintptr_t) object >> 3;
+    return (uint32_t) ((key * 0x9e3779b97f4a7c15u) >> 32) & (capacity - 1);
+}
+
+static IdentityHash *findIdentityHash(IdentityHash *entries, const int capacity, const Obj *object) {
+    uint32_t index = identitySlot(object, capacity);
+    while (entries[index].object != NULL && entries[index].object != object) {
+        index = (index + 1) & (capacity - 1);
+    }
+    return &entries[index];
+}
+
+// Lives outside the collected heap, hashing a key must not start a collection.
+static void growIdentityHashes() {
+    IdentityHashes *table = &vm.identityHashes;
+    const int capacity = GROW_CAPACITY(table->capacity);
+    IdentityHash *entries = calloc(capacity, sizeof(IdentityHash));
+    if (entries == NULL) exit(1);
+
+    for (int i = 0; i < table->capacity; i++) {
+        if (table->entries[i].object == NULL) continue;
+        *findIdentityHash(entries, capacity, table->entries[i].object) = table->entries[i];
+    }
+
+    free(table->entries);
+    table->entries = entries;
+    table->capacity = capacity;
+}
+
+uint32_t hashObject(Obj *object) {
+    if (objType(object) == OBJ_STRING) return ((ObjString *) object)->hash;
+
+    IdentityHashes *table = &vm.identityHashes;
+    if (hasIdentityHash(object)) {
+        return findIdentityHash(table->entries, table->capacity, object)->hash;
+    }
+
+    if (table->count + 1 > table->capacity * 3 / 4) growIdentityHashes();
+    IdentityHash *entry = findIdentityHash(table->entries, table->capacity, object);
+    entry->object = object;
+    entry->hash = ++table->nextHash * 2654435761u;
+    table->count++;
+    setHasIdentityHash(object);
+    return entry->hash;
+}
+
+// Shifts later entries of the probe sequence back into the hole, so no tombstones are needed.
+void removeIdentityHash(const Obj *object) {
+    IdentityHashes *table = &vm.identityHashes;
+    const uint32_t mask = table->capacity - 1;
+    uint32_t hole = findIdentityHash(table->entries, table->capacity, object) - table->entries;
+
+    for (uint32_t index = (hole + 1) & mask; table->entries[index].object != NULL; index = (index + 1) & mask) {
+        const uint32_t home = identitySlot(table->entries[index].object, table->capacity);
+        if (((index - hole) & mask) <= ((index - home) & mask)) {
+            table->entries[hole] = table->entries[index];
+            hole = index;
+        }
+    }
+
+    table->entries[hole].object = NULL;
+    table->count--;
+}
+
+void freeIdentityHashes() {
+    free(vm.identityHashes.entries);
+    vm.identityHashes.entries = NULL;
+    vm.identityHashes.count = 0;
+    vm.identityHashes.capacity = 0;
+}
+
+static ObjString *copyNewString(const char *chars, const int length) {
     const uint32_t hash = hashString(chars, length);
     ObjString *interned = tableFindString(&vm.strings, chars, length, hash);
 
@@ -128,6 +276,24 @@ ObjString *copyString(const char *chars, const int length) {
     return string;
 }
 
+/*
+ * Empty and single character strings skip hashing and the intern table.
+ * They still get interned once, so every other path that builds one of them
+ * ends up with the same object.
+ */
+static ObjString *shortString(const char *chars, const int length) {
+    ObjString **slot = &vm.shortStrings[length == 0 ? 0 : (uint8_t) chars[0] + 1];
+    if (*slot == NULL) {
+        *slot = copyNewString(chars, length);
+    }
+    return *slot;
+}
+
+ObjString *copyString(const char *chars, const int length) {
+    if (length <= 1) return shortString(chars, length);
+    return copyNewString(chars, length);
+}
+
 ObjString *internString(ObjString *string) {
     ObjString *interned = tableFindString(&vm.strings, string->chars, string->length, string->hash);
 
@@ -141,6 +307,8 @@ ObjString *internString(ObjString *string) {
 
 ObjString *concatenateStrings(const char *aChars, const int aLength, const char *bChars, const int bLength) {
     const int length = aLength + bLength;
+    if (length <= 1) return shortString(aLength != 0 ? aChars : bChars, length);
+
     ObjString *result = allocateStringUnlinked(length);
     memcpy(result->chars, aChars, aLength);
     memcpy(result->chars + aLength, bChars, bLength);
@@ -160,7 +328,6 @@ ObjUpvalue *newUpvalue(Value *slot) {
     ObjUpvalue *upvalue = ALLOCATE_OBJ(ObjUpvalue, OBJ_UPVALUE);
     upvalue->location = slot;
     upvalue->closed = NIL_VAL;
-    upvalue->next = NULL;
     return upvalue;
 }
 
@@ -190,6 +357,9 @@ void printObject(const Value value) {
         case OBJ_INSTANCE:
             printf("%s instance", AS_INSTANCE(value)->klass->name->chars);
             break;
+        case OBJ_JUMP_TABLE:
+            printf("<jump table>");
+            break;
         case OBJ_NATIVE:
             printf("<native fn>");
             break;
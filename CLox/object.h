@@ -13,6 +13,7 @@
 #define IS_CLOSURE(value)      isObjType(value, OBJ_CLOSURE)
 #define IS_FUNCTION(value)     isObjType(value, OBJ_FUNCTION)
 #define IS_INSTANCE(value)     isObjType(value, OBJ_INSTANCE)
+#define IS_JUMP_TABLE(value)   isObjType(value, OBJ_JUMP_TABLE)
 #define IS_NATIVE(value)       isObjType(value, OBJ_NATIVE)
 #define IS_STRING(value)       isObjType(value, OBJ_STRING)
 
@@ -21,7 +22,8 @@
 #define AS_CLOSURE(value)      ((ObjClosure*)AS_OBJ(value))
 #define AS_FUNCTION(value)     ((ObjFunction*)AS_OBJ(value))
 #define AS_INSTANCE(value)     ((ObjInstance*)AS_OBJ(value))
-#define AS_NATIVE(value)       (((ObjNative*)AS_OBJ(value))->function)
+#define AS_JUMP_TABLE(value)   ((ObjJumpTable*)AS_OBJ(value))
+#define AS_NATIVE(value)       ((ObjNative*)AS_OBJ(value))
 #define AS_STRING(value)       ((ObjString*)AS_OBJ(value))
 #define AS_CSTRING(value)      (((ObjString*)AS_OBJ(value))->chars)
 
@@ -31,11 +33,17 @@ typedef enum {
     OBJ_CLOSURE,
     OBJ_FUNCTION,
     OBJ_INSTANCE,
+    OBJ_JUMP_TABLE,
     OBJ_NATIVE,
     OBJ_STRING,
     OBJ_UPVALUE
 } ObjType;
 
+/*
+ * The header packs the next object in its low 48 bits, the mark bit in bit 48,
+ * whether the object has an identity hash in vm.identityHashes in bit 49 and
+ * the type in the top byte.
+ */
 struct Obj {
     uint64_t header;
 };
@@ -47,40 +55,70 @@ struct ObjString {
     char chars[];
 };
 
+/*
+ * Identity hashes of every object that has been hashed, other than strings.
+ * Kept out of the objects so the header stays 8 bytes, and taken from a counter
+ * instead of the address so they stay valid if a collector ever moves objects.
+ */
+typedef struct {
+    Obj *object;
+    uint32_t hash;
+} IdentityHash;
+
+typedef struct {
+    int count;
+    int capacity;
+    IdentityHash *entries;
+    uint32_t nextHash;
+} IdentityHashes;
+
 typedef struct ObjUpvalue {
     Obj obj;
     Value *location;
     Value closed;
-    struct ObjUpvalue *next;
 } ObjUpvalue;
 
+typedef struct ObjClosure ObjClosure;
+
 typedef struct {
     Obj obj;
     int arity;
     int upvalueCount;
+    int capturedCount;
+    // Stack slots a frame of this function may use, its deepest point plus FRAME_EXTRA_SLOTS.
+    int stackSlots;
     Chunk chunk;
     ObjString *name;
 } ObjFunction;
 
-typedef struct {
+/*
+ * Variables captured by reference go through upvalues, the ones that can never
+ * change are copied into the captured values stored right after them.
+ */
+struct ObjClosure {
     Obj obj;
     ObjFunction *function;
-    ObjUpvalue **upvalues;
     int upvalueCount;
-} ObjClosure;
+    int capturedCount;
+    ObjUpvalue *upvalues[];
+};
 
-typedef struct {
+typedef struct ObjClass {
     Obj obj;
     ObjString *name;
     ObjClosure *init;
     ObjClosure *superInit;
-    Table methods;
+    struct ObjClass *superclass;
+    // Only the methods the class defines itself, inherited ones are found through superclass.
+    StringTable methods;
+    // Most fields any instance has had so far, new instances start with room for that many.
+    int fieldCount;
 } ObjClass;
 
 typedef struct {
     Obj obj;
     ObjClass *klass;
-    Table fields;
+    StringTable fields;
 } ObjInstance;
 
 typedef struct {
@@ -89,11 +127,42 @@ typedef struct {
     ObjClosure *method;
 } ObjBoundMethod;
 
+/*
+ * Where an OP_SWITCH goes for each of its constant cases, targets maps the case value to
+ * an offset in the code of the chunk. Values without a case go to missTarget.
+ * When the integer cases lie close together they are also stored in dense, indexed by
+ * value - denseMin with -1 for the values without a case, and looked up without hashing.
+ */
+typedef struct {
+    Obj obj;
+    Table targets;
+    int missTarget;
+    int denseMin;
+    int denseCount;
+    int *dense;
+} ObjJumpTable;
+
 typedef bool (*NativeFn)(int argCount, Value *args);
 
+#define NATIVE_VARIADIC (-1)
+
+/*
+ * params describes the signature the VM checks before the native is called,
+ * one character per parameter:
+ *  'a' -> any value
+ *  'n' -> number
+ *  's' -> string
+ *  'i' -> instance
+ * Variadic natives have no signature and check their arguments themselves.
+ * typed is set when at least one parameter is not 'a'.
+ */
 typedef struct {
     Obj obj;
     NativeFn function;
+    const char *name;
+    const char *params;
+    int arity;
+    bool typed;
 } ObjNative;
 
 void linkObject(Obj* object);
@@ -108,7 +177,12 @@ ObjFunction *newFunction();
 
 ObjInstance *newInstance(ObjClass *klass);
 
-ObjNative *newNative(NativeFn function);
+ObjJumpTable *newJumpTable();
+
+// Builds the dense index, called once every case is in targets.
+void finishJumpTable(ObjJumpTable *table);
+
+ObjNative *newNative(NativeFn function, const char *name, const char *params);
 
 ObjString *allocateStringUnlinked(int length);
 
@@ -116,6 +190,13 @@ ObjString *allocateString(int length);
 
 uint32_t hashString(const char *key, int length);
 
+uint32_t hashObject(Obj *object);
+
+// Called when an object with an identity hash is freed.
+void removeIdentityHash(const Obj *object);
+
+void freeIdentityHashes();
+
 ObjString *internString(ObjString *string);
 
 ObjString *copyString(const char *chars, int length);
@@ -126,6 +207,19 @@ ObjUpvalue *newUpvalue(Value *slot);
 
 void printObject(Value value);
 
+static inline int jumpTableTarget(const ObjJumpTable *table, const Value value) {
+    if (table->dense != NULL && IS_NUMBER(value)) {
+        const double index = AS_NUMBER(value) - table->denseMin;
+        if (index >= 0 && index < table->denseCount && index == (int) index) {
+            const int target = table->dense[(int) index];
+            return target != -1 ? target : table->missTarget;
+        }
+    }
+
+    Value found;
+    return tableGet(&table->targets, value, &found) ? (int) AS_NUMBER(found) : table->missTarget;
+}
+
 static inline ObjType objType(const Obj *object) {
     return (ObjType) ((object->header >> 56) & 0xff);
 }
@@ -139,13 +233,29 @@ static inline Obj *nextObj(const Obj *object) {
 }
 
 static inline void setIsMarked(Obj *object, const bool isMarked) {
-    object->header = (object->header & 0xff00ffffffffffff) | ((uint64_t) isMarked << 48);
+    object->header = (object->header & 0xfffeffffffffffff) | ((uint64_t) isMarked << 48);
+}
+
+static inline bool hasIdentityHash(const Obj *object) {
+    return (bool) ((object->header >> 49) & 0x01);
+}
+
+static inline void setHasIdentityHash(Obj *object) {
+    object->header |= (uint64_t) 1 << 49;
 }
 
 static inline void setNextObj(Obj *object, Obj *next) {
     object->header = (object->header & 0xffff000000000000) | (uint64_t) next;
 }
 
+static inline Value *closureCaptured(ObjClosure *closure) {
+    return (Value *) (closure->upvalues + closure->upvalueCount);
+}
+
+static inline size_t closureSize(const int upvalueCount, const int capturedCount) {
+    return sizeof(ObjClosure) + sizeof(ObjUpvalue *) * upvalueCount + sizeof(Value) * capturedCount;
+}
+
 static inline bool isObjType(const Value value, const ObjType type) {
     return IS_OBJ(value) && objType(AS_OBJ(value)) == type;
 }
@@ -3,21 +3,29 @@
 
 #include "common.h"
 
-typedef struct {
-    const char *start;
-    const char *current;
-    int line;
-    int braceCount;
-} Scanner;
+// Long runs of whitespace, identifier characters and string contents are skipped 16 bytes at a time.
+#if defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+#define SCANNER_SIMD
+#include <emmintrin.h>
+#endif
 
 Scanner scanner;
 
-void initScanner(const char *source) {
+void initScanner(const char *source, const size_t length) {
     scanner.start = source;
     scanner.current = source;
+    scanner.end = source + length;
     scanner.line = 1;
 }
 
+Scanner saveScanner() {
+    return scanner;
+}
+
+void restoreScanner(const Scanner state) {
+    scanner = state;
+}
+
 static Token makeToken(const TokenType type) {
     Token token;
     token.type = type;
@@ -37,7 +45,7 @@ static Token errorToken(const char *message) {
 }
 
 static bool isAtEnd() {
-    return *scanner.current == '\0';
+    return scanner.current >= scanner.end;
 }
 
 static char advance() {
@@ -54,12 +62,15 @@ static bool match(const char c) {
     return true;
 }
 
+// Past the end of the source both read as '\0', which no token accepts.
 static char peek() {
+    if (isAtEnd())
+        return '\0';
     return *scanner.current;
 }
 
 static char peekNext() {
-    if (isAtEnd())
+    if (scanner.current + 1 >= scanner.end)
         return '\0';
     return scanner.current[1];
 }
@@ -74,10 +85,52 @@ static bool isAlpha(const char c) {
            c == '_';
 }
 
-static void skipWhitespace() {
+#ifdef SCANNER_SIMD
+// Bit i is set if byte i of the 16 at p equals c.
+static int matchBytes(const __m128i bytes, const char c) {
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(c)));
+}
+
+// Bit i is set if byte i lies in [low, high], both ASCII.
+static int matchRange(const __m128i bytes, const char low, const char high) {
+    const __m128i aboveLow = _mm_cmpgt_epi8(bytes, _mm_set1_epi8((char) (low - 1)));
+    const __m128i belowHigh = _mm_cmplt_epi8(bytes, _mm_set1_epi8((char) (high + 1)));
+    return _mm_movemask_epi8(_mm_and_si128(aboveLow, belowHigh));
+}
+
+static __m128i loadBytes(const char *p) {
+    return _mm_loadu_si128((const __m128i *) p);
+}
+#endif
+
+static int countLines(const char *from, const char *to) {
+    int lines = 0;
+    while ((from = memchr(from, '\n', to - from)) != NULL) {
+        lines++;
+        from++;
+    }
+    return lines;
+}
+
+// Skips spaces, tabs, carriage returns and newlines, counting the newlines.
+static void skipBlanks() {
+#ifdef SCANNER_SIMD
+    while (scanner.end - scanner.current >= 16) {
+        const __m128i bytes = loadBytes(scanner.current);
+        const int newlines = matchBytes(bytes, '\n');
+        const int blanks = newlines | matchBytes(bytes, ' ') | matchBytes(bytes, '\t') | matchBytes(bytes, '\r');
+        if (blanks != 0xffff) {
+            const int skipped = __builtin_ctz(~blanks);
+            scanner.line += __builtin_popcount(newlines & ((1 << skipped) - 1));
+            scanner.current += skipped;
+            return;
+        }
+        scanner.line += __builtin_popcount(newlines);
+        scanner.current += 16;
+    }
+#endif
     for (;;) {
-        const char c = peek();
-        switch (c) {
+        switch (peek()) {
             case ' ':
             case '\r':
             case '\t':
@@ -87,132 +140,115 @@ static void skipWhitespace() {
                 scanner.line++;
                 advance();
                 break;
-            case '/': {
-                const char next = peekNext();
-                if (next == '/') {
-                    while (peek() != '\n' && !isAtEnd()) advance();
-                    break;
-                }
-                if (next == '*') {
-                    while (peek() != '*' && peekNext() != '/' && !isAtEnd()) advance();
-                    break;
-                }
-                return;
-            }
             default:
                 return;
         }
     }
 }
 
-static TokenType checkKeyword(const int start, const int length, const char *rest, const TokenType type) {
-    if (scanner.current - scanner.start == start + length && memcmp(scanner.start + start, rest, length) == 0) {
-        return type;
+static void skipWhitespace() {
+    for (;;) {
+        skipBlanks();
+        if (peek() != '/') return;
+
+        const char next = peekNext();
+        if (next == '/') {
+            // memchr is already vectorized by the C library.
+            const char *newline = memchr(scanner.current, '\n', scanner.end - scanner.current);
+            scanner.current = newline == NULL ? scanner.end : newline;
+        } else if (next == '*') {
+            // An unterminated block comment runs to the end of the source.
+            const char *body = scanner.current + 2;
+            const char *close = memchr(body, '*', scanner.end - body);
+            while (close != NULL && (close + 1 == scanner.end || close[1] != '/')) {
+                close = memchr(close + 1, '*', scanner.end - close - 1);
+            }
+            const char *after = close == NULL ? scanner.end : close + 2;
+            scanner.line += countLines(body, after);
+            scanner.current = after;
+        } else {
+            return;
+        }
     }
-
-    return TOKEN_IDENTIFIER;
 }
 
+/*
+ * Every keyword with its first and last character, which the hash is computed from.
+ * Adding a keyword only takes a line here. If its hash collides with another keyword the
+ * switch in identifierType has a duplicate case and doesn't compile, then KEYWORD_HASH needs
+ * new multipliers.
+ */
+#define KEYWORDS(KEYWORD)                         \
+    KEYWORD("and", 'a', 'd', TOKEN_AND)           \
+    KEYWORD("break", 'b', 'k', TOKEN_BREAK)       \
+    KEYWORD("case", 'c', 'e', TOKEN_CASE)         \
+    KEYWORD("class", 'c', 's', TOKEN_CLASS)       \
+    KEYWORD("const", 'c', 't', TOKEN_CONST)       \
+    KEYWORD("continue", 'c', 'e', TOKEN_CONTINUE) \
+    KEYWORD("default", 'd', 't', TOKEN_DEFAULT)   \
+    KEYWORD("do", 'd', 'o', TOKEN_DO)             \
+    KEYWORD("else", 'e', 'e', TOKEN_ELSE)         \
+    KEYWORD("false", 'f', 'e', TOKEN_FALSE)       \
+    KEYWORD("for", 'f', 'r', TOKEN_FOR)           \
+    KEYWORD("fun", 'f', 'n', TOKEN_FUN)           \
+    KEYWORD("if", 'i', 'f', TOKEN_IF)             \
+    KEYWORD("nil", 'n', 'l', TOKEN_NIL)           \
+    KEYWORD("or", 'o', 'r', TOKEN_OR)             \
+    KEYWORD("print", 'p', 't', TOKEN_PRINT)       \
+    KEYWORD("repeat", 'r', 't', TOKEN_REPEAT)     \
+    KEYWORD("return", 'r', 'n', TOKEN_RETURN)     \
+    KEYWORD("static", 's', 'c', TOKEN_STATIC)     \
+    KEYWORD("super", 's', 'r', TOKEN_SUPER)       \
+    KEYWORD("switch", 's', 'h', TOKEN_SWITCH)     \
+    KEYWORD("this", 't', 's', TOKEN_THIS)         \
+    KEYWORD("true", 't', 'e', TOKEN_TRUE)         \
+    KEYWORD("var", 'v', 'r', TOKEN_VAR)           \
+    KEYWORD("while", 'w', 'e', TOKEN_WHILE)
+
+// Perfect over the keywords above, any other identifier lands on a keyword's slot or on none.
+#define KEYWORD_HASH(first, last, length) (((unsigned) (first) * 6 + (unsigned) (last) * 2 + (unsigned) (length)) & 63)
+
+#define KEYWORD_CASE(name, first, last, type)                                      \
+    case KEYWORD_HASH(first, last, sizeof(name) - 1):                                \
+        if (length == sizeof(name) - 1 && memcmp(scanner.start, name, length) == 0) \
+            return type;                                                             \
+        return TOKEN_IDENTIFIER;
+
+// The hash picks the only keyword the identifier can be, a single comparison settles it.
 static TokenType identifierType() {
-    switch (scanner.start[0]) {
-        case 'a':
-            return checkKeyword(1, 2, "nd", TOKEN_AND);
-        case 'b':
-            return checkKeyword(1, 4, "reak", TOKEN_BREAK);
-        case 'c':
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
-                    case 'a':
-                        return checkKeyword(2, 2, "se", TOKEN_CASE);
-                    case 'l':
-                        return checkKeyword(2, 3, "ass", TOKEN_CLASS);
-                    case 'o': {
-                        if (scanner.start[2] == 'n') {
-                            switch (scanner.start[3]) {
-                                case 's':
-                                    return checkKeyword(4, 1, "t", TOKEN_CONST);
-                                case 't':
-                                    return checkKeyword(4, 4, "inue", TOKEN_CONTINUE);
-                            }
-                        }
-                    }
-                }
-            }
-            break;
-        case 'd':
-            if (scanner.current - scanner.start > 1) {
-                if (scanner.start[1] == 'o') {
-                    return TOKEN_DO;
-                }
-                return checkKeyword(1, 6, "efault", TOKEN_DEFAULT);
-            }
-        case 'e':
-            return checkKeyword(1, 3, "lse", TOKEN_ELSE);
-        case 'i':
-            return checkKeyword(1, 1, "f", TOKEN_IF);
-        case 'n':
-            return checkKeyword(1, 2, "il", TOKEN_NIL);
-        case 'o':
-            return checkKeyword(1, 1, "r", TOKEN_OR);
-        case 'p':
-            return checkKeyword(1, 4, "rint", TOKEN_PRINT);
-        case 'r':
-            if (scanner.current - scanner.start > 1) {
-                if (scanner.start[1] == 'e') {
-                    switch (scanner.start[2]) {
-                        case 't':
-                            return checkKeyword(3, 3, "urn", TOKEN_RETURN);
-                        case 'p':
-                            return checkKeyword(3, 3, "eat", TOKEN_REPEAT);
-                    }
-                }
-            }
-        case 's':
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
-                    case 't':
-                        return checkKeyword(2, 4, "atic", TOKEN_STATIC);
-                    case 'u':
-                        return checkKeyword(2, 3, "per", TOKEN_SUPER);
-                    case 'w':
-                        return checkKeyword(2, 4, "itch", TOKEN_SWITCH);
-                }
-            }
-        case 'v':
-            return checkKeyword(1, 2, "ar", TOKEN_VAR);
-        case 'w':
-            return checkKeyword(1, 4, "hile", TOKEN_WHILE);
-        case 'f':
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
-                    case 'a':
-                        return checkKeyword(2, 3, "lse", TOKEN_FALSE);
-                    case 'o':
-                        return checkKeyword(2, 1, "r", TOKEN_FOR);
-                    case 'u':
-                        return checkKeyword(2, 1, "n", TOKEN_FUN);
-                }
-            }
-            break;
-        case 't':
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
-                    case 'h':
-                        return checkKeyword(2, 2, "is", TOKEN_THIS);
-                    case 'r':
-                        return checkKeyword(2, 2, "ue", TOKEN_TRUE);
-                }
-            }
-            break;
+    const size_t length = scanner.current - scanner.start;
+    switch (KEYWORD_HASH(scanner.start[0], scanner.current[-1], length)) {
+        KEYWORDS(KEYWORD_CASE)
+        default:
+            return TOKEN_IDENTIFIER;
     }
+}
 
-    return TOKEN_IDENTIFIER;
+#undef KEYWORD_CASE
+
+// Moves to the next '"', '$' or newline of a string.
+static void skipStringChars() {
+#ifdef SCANNER_SIMD
+    while (scanner.end - scanner.current >= 16) {
+        const __m128i bytes = loadBytes(scanner.current);
+        const int stops = matchBytes(bytes, '"') | matchBytes(bytes, '$') | matchBytes(bytes, '\n');
+        if (stops != 0) {
+            scanner.current += __builtin_ctz(stops);
+            return;
+        }
+        scanner.current += 16;
+    }
+#endif
+    while (peek() != '"' && peek() != '$' && peek() != '\n' && !isAtEnd()) {
+        advance();
+    }
 }
 
 static Token string() {
-    while (peek() != '"' && peek() != '$' && !isAtEnd()) {
-        if (peek() == '\n')
-            scanner.line++;
+    for (;;) {
+        skipStringChars();
+        if (peek() != '\n') break;
+        scanner.line++;
         advance();
     }
 
@@ -249,6 +285,19 @@ static Token number() {
 }
 
 static Token identifier() {
+#ifdef SCANNER_SIMD
+    while (scanner.end - scanner.current >= 16) {
+        const __m128i bytes = loadBytes(scanner.current);
+        // Or-ing in 0x20 turns upper case letters into lower case ones and keeps other characters out of a-z.
+        const __m128i lower = _mm_or_si128(bytes, _mm_set1_epi8(0x20));
+        const int identifierChars = matchRange(lower, 'a', 'z') | matchRange(bytes, '0', '9') | matchBytes(bytes, '_');
+        if (identifierChars != 0xffff) {
+            scanner.current += __builtin_ctz(~identifierChars);
+            return makeToken(identifierType());
+        }
+        scanner.current += 16;
+    }
+#endif
     while (isAlpha(peek()) || isDigit(peek()))
         advance();
     return makeToken(identifierType());
@@ -80,8 +80,24 @@ typedef struct {
     int line;
 } Token;
 
-void initScanner(const char *source);
+#include <stddef.h>
+
+typedef struct {
+    const char *start;
+    const char *current;
+    const char *end;
+    int line;
+    int braceCount;
+} Scanner;
+
+// The source doesn't have to be terminated, the scanner never reads past source + length.
+void initScanner(const char *source, size_t length);
 
 Token scanToken();
 
+// Lets the compiler scan ahead and come back to where it was.
+Scanner saveScanner();
+
+void restoreScanner(Scanner state);
+
 #endif // clox_scanner_h
@@ -2,26 +2,14 @@
 #include "../utils/coerce.h"
 #include "../object.h"
 
-bool strNative(const int argCount, Value *args)
+bool strNative(int _, Value *args)
 {
-    if (argCount != 1)
-    {
-        args[-1] = OBJ_VAL(copyString("Unexpected amount of arguments for 'str'.", 41));
-        return false;
-    }
-
     args[-1] = toString(args[0]);
     return true;
 }
 
-bool numberNative(const int argCount, Value *args)
+bool numberNative(int _, Value *args)
 {
-    if (argCount != 1)
-    {
-        args[-1] = OBJ_VAL(copyString("Unexpected amount of arguments for 'number'.", 44));
-        return false;
-    }
-
     Value result;
     if (toNumber(args[0], &result))
     {
@@ -33,27 +21,15 @@ bool numberNative(const int argCount, Value *args)
     return false;
 }
 
-bool tryNumberNative(const int argCount, Value *args)
+bool tryNumberNative(int _, Value *args)
 {
-    if (argCount != 1)
-    {
-        args[-1] = OBJ_VAL(copyString("Unexpected amount of arguments for 'tryNumber'.", 47));
-        return false;
-    }
-
     Value result;
     args[-1] = toNumber(args[0], &result) ? result : NIL_VAL;
     return true;
 }
 
-bool boolNative(const int argCount, Value *args)
+bool boolNative(int _, Value *args)
 {
-    if (argCount != 1)
-    {
-        args[-1] = OBJ_VAL(copyString("Unexpected amount of arguments for 'bool'.", 42));
-        return false;
-    }
-
     args[-1] = toBool(args[0]);
     return true;
 }
\ No newline at end of file
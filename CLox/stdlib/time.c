@@ -25,19 +25,8 @@ static void sleep_ms(int milliseconds)
     #endif
 }
 
-bool sleepNative(const int argCount, Value* args) {
-    if (argCount != 1) {
-        args[-1] = OBJ_VAL(copyString("Unexpected amount of arguments for 'sleep'.", 43));
-        return false;
-    }
-
-    const Value value = args[0];
-    if (!IS_NUMBER(value)) {
-        args[-1] = OBJ_VAL(copyString("Expected number as argument for 'sleep'.", 40));
-        return false;
-    }
-
-    sleep_ms(AS_NUMBER(value) * 1000);
+bool sleepNative(int _, Value* args) {
+    sleep_ms(AS_NUMBER(args[0]) * 1000);
     args[-1] = NIL_VAL;
     return true;
 }
\ No newline at end of file
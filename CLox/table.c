@@ -6,18 +6,102 @@
 #include "value.h"
 #include "vm.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TABLE_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#define CTRL_EMPTY   ((uint8_t) 0x80)
+#define CTRL_DELETED ((uint8_t) 0xfe)
+
+#define H1(hash) ((hash) >> 7)
+#define H2(hash) ((uint8_t) ((hash) & 0x7f))
+
+#define IS_FULL(ctrl) (((ctrl) & 0x80) == 0)
+
+// Bit i is set if slot i of the group matched.
+typedef uint32_t GroupMask;
 
 void initTable(Table *table) {
     table->count = 0;
+    table->tombstones = 0;
     table->capacity = 0;
     table->entries = NULL;
+    table->control = NULL;
+}
+
+// Tables smaller than one group still get a full group of control bytes,
+// the slots past the capacity stay empty forever.
+static int controlBytes(const int capacity) {
+    return capacity < TABLE_GROUP_WIDTH ? TABLE_GROUP_WIDTH : capacity;
+}
+
+static size_t tableBytes(const size_t entrySize, const int capacity) {
+    return entrySize * capacity + controlBytes(capacity);
+}
+
+// Entries and control bytes share one allocation, the control bytes come last.
+static void *allocateSlots(const size_t entrySize, const int capacity, uint8_t **control) {
+    uint8_t *slots = reallocate(NULL, 0, tableBytes(entrySize, capacity));
+    *control = slots + entrySize * capacity;
+    memset(*control, CTRL_EMPTY, controlBytes(capacity));
+    return slots;
+}
+
+static void freeSlots(void *slots, const size_t entrySize, const int capacity) {
+    if (capacity > 0) {
+        reallocate(slots, tableBytes(entrySize, capacity), 0);
+    }
 }
 
 void freeTable(Table *table) {
-    FREE_ARRAY(Entry, table->entries, table->capacity);
+    freeSlots(table->entries, sizeof(Entry), table->capacity);
     initTable(table);
 }
 
+static inline int lowestBit(GroupMask mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(mask);
+#else
+    int index = 0;
+    while ((mask & 1) == 0) {
+        mask >>= 1;
+        index++;
+    }
+    return index;
+#endif
+}
+
+static inline GroupMask groupMatch(const uint8_t *group, const uint8_t h2) {
+#ifdef TABLE_USE_SSE2
+    const __m128i ctrl = _mm_loadu_si128((const __m128i *) group);
+    return (GroupMask) _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char) h2)));
+#else
+    GroupMask mask = 0;
+    for (int i = 0; i < TABLE_GROUP_WIDTH; i++) {
+        if (group[i] == h2) mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+static inline GroupMask groupMatchEmpty(const uint8_t *group) {
+    return groupMatch(group, CTRL_EMPTY);
+}
+
+// Empty and deleted are the only control bytes with the high bit set.
+static inline GroupMask groupMatchEmptyOrDeleted(const uint8_t *group) {
+#ifdef TABLE_USE_SSE2
+    return (GroupMask) _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) group));
+#else
+    GroupMask mask = 0;
+    for (int i = 0; i < TABLE_GROUP_WIDTH; i++) {
+        if (!IS_FULL(group[i])) mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
 static uint32_t hashDouble(const double value) {
     union BitCast {
         double value;
@@ -34,116 +118,219 @@ static uint32_t hashValue(const Value value) {
         case VAL_BOOL: return AS_BOOL(value) ? 3 : 5;
         case VAL_NIL: return 7;
         case VAL_NUMBER: return hashDouble(AS_NUMBER(value));
-        case VAL_OBJ: return AS_STRING(value)->hash;
+        case VAL_OBJ:
+            // Bound methods compare by what they bind, so equal ones have to hash the same.
+            if (objType(AS_OBJ(value)) == OBj_BOUND_METHOD) {
+                const ObjBoundMethod *bound = AS_BOUND_METHOD(value);
+                return hashValue(bound->receiver) * 31 + hashObject((Obj *) bound->method);
+            }
+            return hashObject(AS_OBJ(value));
         case VAL_EMPTY: return 0;
         default: return -1; // Unreachable
     }
 }
 
-static Entry *findEntry(Entry *entries, const int capacity, const Value key) {
-    uint32_t index = hashValue(key) % capacity;
-    Entry *tombstone = NULL;
+static uint32_t groupCount(const int capacity) {
+    return capacity < TABLE_GROUP_WIDTH ? 1 : capacity / TABLE_GROUP_WIDTH;
+}
+
+/*
+ * Groups are probed with triangular steps (1, 2, 3, ...), which visits
+ * every group once since the group count is a power of two.
+ */
+static int findEntry(const Table *table, const Value key, const uint32_t hash) {
+    if (table->capacity == 0) return -1;
 
-    for (;;) {
-        Entry *entry = &entries[index];
-        if (entry->key.type == VAL_EMPTY) {
-            if (IS_NIL(entry->value)) {
-                return tombstone != NULL ? tombstone : entry;
+    const uint32_t groupMask = groupCount(table->capacity) - 1;
+    const uint8_t h2 = H2(hash);
+    uint32_t group = H1(hash) & groupMask;
+
+    for (uint32_t step = 1;; step++) {
+        const uint8_t *control = &table->control[group * TABLE_GROUP_WIDTH];
+
+        GroupMask match = groupMatch(control, h2);
+        while (match != 0) {
+            const int index = (int) group * TABLE_GROUP_WIDTH + lowestBit(match);
+            if (valuesEqual(key, table->entries[index].key)) {
+                return index;
             }
-            if (tombstone == NULL) tombstone = entry;
-        } else if (valuesEqual(key, entry->key)) {
-            return entry;
+            match &= match - 1;
+        }
+
+        if (groupMatchEmpty(control) != 0) return -1;
+        group = (group + step) & groupMask;
+    }
+}
+
+static int findFreeSlot(const uint8_t *control, const int capacity, const uint32_t hash) {
+    const uint32_t groupMask = groupCount(capacity) - 1;
+    const GroupMask validMask = capacity < TABLE_GROUP_WIDTH ? (1u << capacity) - 1 : 0xffff;
+    uint32_t group = H1(hash) & groupMask;
+
+    for (uint32_t step = 1;; step++) {
+        const GroupMask candidates = groupMatchEmptyOrDeleted(&control[group * TABLE_GROUP_WIDTH]) & validMask;
+        if (candidates != 0) {
+            return (int) group * TABLE_GROUP_WIDTH + lowestBit(candidates);
         }
+        group = (group + step) & groupMask;
+    }
+}
+
+static bool needsResize(const int count, const int tombstones, const int capacity) {
+    return count + tombstones + 1 > capacity * TABLE_MAX_LOAD;
+}
+
+static int resizedCapacity(const int count, const int tombstones, const int capacity) {
+    // Mostly tombstones, rehashing at the same size is enough to make room.
+    return tombstones > count ? capacity : GROW_CAPACITY(capacity);
+}
+
+/*
+ * Probing stops at the first group with an empty slot, so no key was ever
+ * pushed past a group that still has one. Such a slot can become empty again
+ * instead of leaving a tombstone behind.
+ * Returns true if a tombstone was left.
+ */
+static bool clearSlot(uint8_t *control, const int index) {
+    const int group = index - index % TABLE_GROUP_WIDTH;
+    if (groupMatchEmpty(&control[group]) != 0) {
+        control[index] = CTRL_EMPTY;
+        return false;
+    }
+
+    control[index] = CTRL_DELETED;
+    return true;
+}
 
-        index = (index + 1) % capacity;
+// Tables of a single group are left alone, they are cheap and shrinking
+// them would make small tables bounce between two sizes.
+static int compactedCapacity(const int count, int capacity) {
+    while (capacity > TABLE_GROUP_WIDTH && count < capacity * TABLE_MIN_LOAD) {
+        capacity /= 2;
     }
+    return capacity;
 }
 
 bool tableGet(const Table *table, const Value key, Value *value) {
     if (table->count == 0) return false;
-    const Entry *entry = findEntry(table->entries, table->capacity, key);
-    if (entry->key.type == VAL_EMPTY) return false;
-    *value = entry->value;
+    const int index = findEntry(table, key, hashValue(key));
+    if (index == -1) return false;
+    *value = table->entries[index].value;
     return true;
 }
 
 static void adjustCapacity(Table *table, const int capacity) {
-    Entry *entries = ALLOCATE(Entry, capacity);
-    for (int i = 0; i < capacity; i++) {
-        entries[i].key = EMPTY_VAL;
-        entries[i].value = NIL_VAL;
-    }
+    uint8_t *control;
+    Entry *entries = allocateSlots(sizeof(Entry), capacity, &control);
 
     table->count = 0;
+    table->tombstones = 0;
     for (int i = 0; i < table->capacity; i++) {
+        if (!IS_FULL(table->control[i])) continue;
+
         const Entry *entry = &table->entries[i];
-        if (entry->key.type == VAL_EMPTY) continue;
-        Entry *dest = findEntry(entries, capacity, entry->key);
-        dest->key = entry->key;
-        dest->value = entry->value;
+        const uint32_t hash = hashValue(entry->key);
+        const int index = findFreeSlot(control, capacity, hash);
+        control[index] = H2(hash);
+        entries[index] = *entry;
         table->count++;
     }
 
-    FREE_ARRAY(Entry, table->entries, table->capacity);
+    freeSlots(table->entries, sizeof(Entry), table->capacity);
     table->entries = entries;
+    table->control = control;
     table->capacity = capacity;
 }
 
 bool tableSet(Table *table, const Value key, const Value value) {
-    if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
-        const int capacity = GROW_CAPACITY(table->capacity);
-        adjustCapacity(table, capacity);
+    const uint32_t hash = hashValue(key);
+
+    const int existing = findEntry(table, key, hash);
+    if (existing != -1) {
+        table->entries[existing].value = value;
+        return false;
     }
 
-    Entry *entry = findEntry(table->entries, table->capacity, key);
-    const bool isNewKey = entry->key.type == VAL_EMPTY;
-    if (isNewKey && IS_NIL(entry->value)) table->count++;
+    if (needsResize(table->count, table->tombstones, table->capacity)) {
+        adjustCapacity(table, resizedCapacity(table->count, table->tombstones, table->capacity));
+    }
 
-    entry->key = key;
-    entry->value = value;
-    return isNewKey;
+    const int index = findFreeSlot(table->control, table->capacity, hash);
+    if (table->control[index] == CTRL_DELETED) table->tombstones--;
+    table->count++;
+
+    table->control[index] = H2(hash);
+    table->entries[index].key = key;
+    table->entries[index].value = value;
+    return true;
+}
+
+static void removeEntry(Table *table, const int index) {
+    if (clearSlot(table->control, index)) table->tombstones++;
+
+    table->entries[index].key = EMPTY_VAL;
+    table->entries[index].value = EMPTY_VAL;
+    table->count--;
 }
 
-bool tableDelete(const Table *table, const Value key) {
+bool tableDelete(Table *table, const Value key) {
     if (table->count == 0) return false;
 
-    Entry *entry = findEntry(table->entries, table->capacity, key);
-    if (entry->key.type == VAL_EMPTY) return false;
+    const int index = findEntry(table, key, hashValue(key));
+    if (index == -1) return false;
 
-    entry->key = EMPTY_VAL;
-    entry->value = EMPTY_VAL;
+    removeEntry(table, index);
+    tableCompact(table);
     return true;
 }
 
 void tableAddAll(const Table *from, Table *to) {
     for (int i = 0; i < from->capacity; i++) {
-        const Entry *entry = &from->entries[i];
-        if (entry->key.type != VAL_EMPTY) {
+        if (IS_FULL(from->control[i])) {
+            const Entry *entry = &from->entries[i];
             tableSet(to, entry->key, entry->value);
         }
     }
 }
 
+Entry *tableNextEntry(const Table *table, int *index) {
+    for ((*index)++; *index < table->capacity; (*index)++) {
+        if (IS_FULL(table->control[*index])) return &table->entries[*index];
+    }
+    return NULL;
+}
+
 ObjString *tableFindString(const Table *table, const char *chars, const int length, const uint32_t hash) {
     if (table->count == 0) return NULL;
 
-    uint32_t index = hash % table->capacity;
-    for (;;) {
-        const Entry *entry = &table->entries[index];
-        if (entry->key.type == VAL_EMPTY) {
-            if (IS_NIL(entry->value)) return NULL;
-        } else if (AS_STRING(entry->key)->length == length
-                   && AS_STRING(entry->key)->hash == hash
-                   && memcmp(AS_STRING(entry->key)->chars, chars, length) == 0) {
-            return AS_STRING(entry->key);
+    const uint32_t groupMask = groupCount(table->capacity) - 1;
+    const uint8_t h2 = H2(hash);
+    uint32_t group = H1(hash) & groupMask;
+
+    for (uint32_t step = 1;; step++) {
+        const uint8_t *control = &table->control[group * TABLE_GROUP_WIDTH];
+
+        GroupMask match = groupMatch(control, h2);
+        while (match != 0) {
+            const int index = (int) group * TABLE_GROUP_WIDTH + lowestBit(match);
+            ObjString *string = AS_STRING(table->entries[index].key);
+            if (string->length == length
+                && string->hash == hash
+                && memcmp(string->chars, chars, length) == 0) {
+                return string;
+            }
+            match &= match - 1;
         }
 
-        index = (index + 1) % table->capacity;
+        if (groupMatchEmpty(control) != 0) return NULL;
+        group = (group + step) & groupMask;
     }
 }
 
 void markTable(Table *table) {
     for (int i = 0; i < table->capacity; i++) {
+        if (!IS_FULL(table->control[i])) continue;
+
         Entry *entry = &table->entries[i];
         markValue(entry->key);
         markValue(entry->value);
@@ -152,9 +339,172 @@ void markTable(Table *table) {
 
 void tableRemoveWhiet(Table *table) {
     for (int i = 0; i < table->capacity; i++) {
-        Entry *entry = &table->entries[i];
-        if (entry->key.type != VAL_EMPTY && IS_OBJ(entry->key) && getMarkValue(AS_OBJ(entry->key)) != vm.markValue) {
-            tableDelete(table, entry->key);
+        if (!IS_FULL(table->control[i])) continue;
+
+        const Entry *entry = &table->entries[i];
+        if (IS_OBJ(entry->key) && getMarkValue(AS_OBJ(entry->key)) != vm.markValue) {
+            removeEntry(table, i);
         }
     }
 }
+
+/*
+ * Releases the memory of tables which lost most of their entries and gets rid
+ * of tombstones once they make up most of the load.
+ * This allocates, the collector calls it last and doesn't collect again while it does.
+ */
+void tableCompact(Table *table) {
+    if (table->capacity == 0) return;
+
+    if (table->count == 0) {
+        freeTable(table);
+        return;
+    }
+
+    const int capacity = compactedCapacity(table->count, table->capacity);
+    if (capacity != table->capacity || table->tombstones > table->count) {
+        adjustCapacity(table, capacity);
+    }
+}
+
+void initStringTable(StringTable *table) {
+    table->count = 0;
+    table->tombstones = 0;
+    table->capacity = 0;
+    table->entries = NULL;
+    table->control = NULL;
+}
+
+void freeStringTable(StringTable *table) {
+    freeSlots(table->entries, sizeof(StringEntry), table->capacity);
+    initStringTable(table);
+}
+
+void initStringTableSized(StringTable *table, const int count) {
+    initStringTable(table);
+    if (count <= 0) return;
+
+    int capacity = GROW_CAPACITY(0);
+    while (needsResize(count - 1, 0, capacity)) {
+        capacity = GROW_CAPACITY(capacity);
+    }
+    table->entries = allocateSlots(sizeof(StringEntry), capacity, &table->control);
+    table->capacity = capacity;
+}
+
+// Keys are interned, so the same name is always the same object.
+static int findStringEntry(const StringTable *table, const ObjString *key) {
+    if (table->count == 0) return -1;
+
+    const uint32_t groupMask = groupCount(table->capacity) - 1;
+    const uint8_t h2 = H2(key->hash);
+    uint32_t group = H1(key->hash) & groupMask;
+
+    for (uint32_t step = 1;; step++) {
+        const uint8_t *control = &table->control[group * TABLE_GROUP_WIDTH];
+
+        GroupMask match = groupMatch(control, h2);
+        while (match != 0) {
+            const int index = (int) group * TABLE_GROUP_WIDTH + lowestBit(match);
+            if (table->entries[index].key == key) {
+                return index;
+            }
+            match &= match - 1;
+        }
+
+        if (groupMatchEmpty(control) != 0) return -1;
+        group = (group + step) & groupMask;
+    }
+}
+
+bool stringTableGet(const StringTable *table, const ObjString *key, Value *value) {
+    const int index = findStringEntry(table, key);
+    if (index == -1) return false;
+    *value = table->entries[index].value;
+    return true;
+}
+
+static void adjustStringCapacity(StringTable *table, const int capacity) {
+    uint8_t *control;
+    StringEntry *entries = allocateSlots(sizeof(StringEntry), capacity, &control);
+
+    table->count = 0;
+    table->tombstones = 0;
+    for (int i = 0; i < table->capacity; i++) {
+        if (!IS_FULL(table->control[i])) continue;
+
+        const StringEntry *entry = &table->entries[i];
+        const int index = findFreeSlot(control, capacity, entry->hash);
+        control[index] = H2(entry->hash);
+        entries[index] = *entry;
+        table->count++;
+    }
+
+    freeSlots(table->entries, sizeof(StringEntry), table->capacity);
+    table->entries = entries;
+    table->control = control;
+    table->capacity = capacity;
+}
+
+bool stringTableSet(StringTable *table, ObjString *key, const Value value) {
+    const int existing = findStringEntry(table, key);
+    if (existing != -1) {
+        table->entries[existing].value = value;
+        return false;
+    }
+
+    if (needsResize(table->count, table->tombstones, table->capacity)) {
+        adjustStringCapacity(table, resizedCapacity(table->count, table->tombstones, table->capacity));
+    }
+
+    const int index = findFreeSlot(table->control, table->capacity, key->hash);
+    if (table->control[index] == CTRL_DELETED) table->tombstones--;
+    table->count++;
+
+    table->control[index] = H2(key->hash);
+    StringEntry *entry = &table->entries[index];
+    entry->key = key;
+    entry->hash = key->hash;
+    entry->value = value;
+    return true;
+}
+
+bool stringTableDelete(StringTable *table, const ObjString *key) {
+    const int index = findStringEntry(table, key);
+    if (index == -1) return false;
+
+    if (clearSlot(table->control, index)) table->tombstones++;
+    table->entries[index].key = NULL;
+    table->entries[index].value = EMPTY_VAL;
+    table->count--;
+
+    if (table->count == 0) {
+        freeStringTable(table);
+        return true;
+    }
+
+    const int capacity = compactedCapacity(table->count, table->capacity);
+    if (capacity != table->capacity || table->tombstones > table->count) {
+        adjustStringCapacity(table, capacity);
+    }
+    return true;
+}
+
+void stringTableAddAll(const StringTable *from, StringTable *to) {
+    for (int i = 0; i < from->capacity; i++) {
+        if (IS_FULL(from->control[i])) {
+            const StringEntry *entry = &from->entries[i];
+            stringTableSet(to, entry->key, entry->value);
+        }
+    }
+}
+
+void markStringTable(StringTable *table) {
+    for (int i = 0; i < table->capacity; i++) {
+        if (!IS_FULL(table->control[i])) continue;
+
+        StringEntry *entry = &table->entries[i];
+        markObject((Obj *) entry->key);
+        markValue(entry->value);
+    }
+}
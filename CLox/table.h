@@ -9,13 +9,48 @@ typedef struct {
     Value value;
 } Entry;
 
+/*
+ * Open addressing table in the style of a swiss table.
+ * Every slot has one control byte, stored in a separate array after the entries:
+ *  0x80          -> empty
+ *  0xfe          -> deleted (tombstone)
+ *  0x00 - 0x7f   -> full, holds the lower 7 bits of the key hash
+ * Lookups compare a whole group of control bytes at once and only touch
+ * the entries whose hash fragment matches.
+ * count only holds live entries, tombstones are tracked separately but both
+ * count towards the load of the table.
+ */
 typedef struct {
     int count;
+    int tombstones;
     int capacity;
     Entry *entries;
+    uint8_t *control;
 } Table;
 
+/*
+ * Same layout as Table, but only for keys that are interned strings.
+ * Interning makes the key pointer unique, so keys are compared by identity
+ * and the hash is kept next to the key for rehashing.
+ * Used for property, method and global names.
+ */
+typedef struct {
+    ObjString *key;
+    uint32_t hash;
+    Value value;
+} StringEntry;
+
+typedef struct {
+    int count;
+    int tombstones;
+    int capacity;
+    StringEntry *entries;
+    uint8_t *control;
+} StringTable;
+
 #define TABLE_MAX_LOAD 0.75
+#define TABLE_MIN_LOAD 0.25
+#define TABLE_GROUP_WIDTH 16
 
 void initTable(Table *table);
 
@@ -25,14 +60,36 @@ bool tableGet(const Table *table, Value key, Value *value);
 
 bool tableSet(Table *table, Value key, Value value);
 
-bool tableDelete(const Table *table, Value key);
+bool tableDelete(Table *table, Value key);
 
 void tableAddAll(const Table *from, Table *to);
 
+// Moves index (-1 to start) to the next live entry and returns it, NULL once there are no more.
+Entry *tableNextEntry(const Table *table, int *index);
+
 ObjString *tableFindString(const Table *table, const char *chars, int length, uint32_t hash);
 
 void markTable(Table *table);
 
 void tableRemoveWhiet(Table *table);
 
+void tableCompact(Table *table);
+
+void initStringTable(StringTable *table);
+
+void freeStringTable(StringTable *table);
+
+// Starts with room for count entries, so the table doesn't grow until more are added.
+void initStringTableSized(StringTable *table, int count);
+
+bool stringTableGet(const StringTable *table, const ObjString *key, Value *value);
+
+bool stringTableSet(StringTable *table, ObjString *key, Value value);
+
+bool stringTableDelete(StringTable *table, const ObjString *key);
+
+void stringTableAddAll(const StringTable *from, StringTable *to);
+
+void markStringTable(StringTable *table);
+
 #endif //clox_table_h
@@ -1,4 +1,15 @@
 ﻿#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+    #define MAP_SOURCE_FILES 0
+#else
+    #define MAP_SOURCE_FILES 1
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
 
 #include "io.h"
 #include "../object.h"
@@ -39,3 +50,103 @@ ObjString* readLine(FILE* in) {
     free(buffer);
     return string;
 }
+
+void initInputBuffer(InputBuffer* buffer) {
+    buffer->data = NULL;
+    buffer->length = 0;
+    buffer->capacity = 0;
+}
+
+void freeInputBuffer(InputBuffer* buffer) {
+    free(buffer->data);
+    initInputBuffer(buffer);
+}
+
+bool appendLine(FILE* in, InputBuffer* buffer) {
+    const size_t start = buffer->length;
+    for (;;) {
+        if (buffer->capacity - buffer->length < 2) {
+            const size_t capacity = buffer->capacity < 128 ? 128 : buffer->capacity * 2;
+            char* data = realloc(buffer->data, capacity);
+            if (!data) return false;
+            buffer->data = data;
+            buffer->capacity = capacity;
+        }
+
+        char* end = buffer->data + buffer->length;
+        if (!fgets(end, (int)(buffer->capacity - buffer->length), in)) {
+            return buffer->length > start;
+        }
+        buffer->length += strlen(end);
+        if (buffer->data[buffer->length - 1] == '\n') return true;
+    }
+}
+
+static bool readSourceFile(const char* path, SourceFile* file) {
+    FILE* in = fopen(path, "rb");
+    if (in == NULL) return false;
+
+    fseek(in, 0L, SEEK_END);
+    const long size = ftell(in);
+    rewind(in);
+
+    char* buffer = malloc(size > 0 ? size : 1);
+    if (size < 0 || buffer == NULL || fread(buffer, sizeof(char), size, in) < (size_t)size) {
+        free(buffer);
+        fclose(in);
+        return false;
+    }
+
+    fclose(in);
+    if (size == 0) free(buffer);
+    file->data = size == 0 ? "" : buffer;
+    file->size = size;
+    file->mapped = false;
+    return true;
+}
+
+bool openSourceFile(const char* path, SourceFile* file) {
+#if MAP_SOURCE_FILES
+    const int fd = open(path, O_RDONLY);
+    if (fd == -1) return false;
+
+    struct stat info;
+    if (fstat(fd, &info) == -1 || !S_ISREG(info.st_mode)) {
+        close(fd);
+        return readSourceFile(path, file);
+    }
+
+    // Mapping nothing fails, an empty file doesn't need it anyway.
+    if (info.st_size == 0) {
+        close(fd);
+        file->data = "";
+        file->size = 0;
+        file->mapped = false;
+        return true;
+    }
+
+    void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return readSourceFile(path, file);
+
+    file->data = data;
+    file->size = info.st_size;
+    file->mapped = true;
+    return true;
+#else
+    return readSourceFile(path, file);
+#endif
+}
+
+// Empty files point at a string literal, there is nothing to release for them.
+void closeSourceFile(SourceFile* file) {
+    if (file->mapped) {
+#if MAP_SOURCE_FILES
+        munmap((void*)file->data, file->size);
+#endif
+    } else if (file->size > 0) {
+        free((void*)file->data);
+    }
+    file->data = NULL;
+    file->size = 0;
+}
@@ -8,4 +8,30 @@
 
 ObjString* readLine(FILE* in);
 
+// Text read from a stream a line at a time, grows as needed.
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+} InputBuffer;
+
+void initInputBuffer(InputBuffer* buffer);
+
+void freeInputBuffer(InputBuffer* buffer);
+
+// Appends the next line of in with its newline, returns false if in had nothing left.
+bool appendLine(FILE* in, InputBuffer* buffer);
+
+typedef struct {
+    const char* data;
+    size_t size;
+    bool mapped;
+} SourceFile;
+
+// Maps the file into memory where the platform allows it, otherwise reads it into a buffer.
+// The data is not NUL terminated.
+bool openSourceFile(const char* path, SourceFile* file);
+
+void closeSourceFile(SourceFile* file);
+
 #endif //CLOX_FILEUTILS_H
\ No newline at end of file
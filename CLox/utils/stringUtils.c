@@ -16,6 +16,16 @@ Value joinString(const int argCount, Value *args) {
         length += AS_STRING(args[i])->length;
     }
 
+    if (length <= 1) {
+        char c = '\0';
+        for (int i = 0; i < argCount; i++)
+        {
+            if (AS_STRING(args[i])->length != 0) c = AS_STRING(args[i])->chars[0];
+        }
+
+        return OBJ_VAL(copyString(&c, length));
+    }
+
     ObjString *result = allocateStringUnlinked(length);
 
     int current = 0;
@@ -46,6 +46,12 @@ bool valuesEqual(const Value a, const Value b) {
                        memcmp(aString->chars, bString->chars,
                               aString->length) == 0;
             }
+            // Bound methods may or may not come from the cache, so they compare by what they bind.
+            if (objType(AS_OBJ(a)) == OBj_BOUND_METHOD && objType(AS_OBJ(b)) == OBj_BOUND_METHOD) {
+                const ObjBoundMethod *aBound = AS_BOUND_METHOD(a);
+                const ObjBoundMethod *bBound = AS_BOUND_METHOD(b);
+                return aBound->method == bBound->method && valuesEqual(aBound->receiver, bBound->receiver);
+            }
             return AS_OBJ(a) == AS_OBJ(b);
         }
         default:
@@ -1,9 +1,11 @@
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <math.h>
 
+#include "bytecode.h"
 #include "chunk.h"
 #include "common.h"
 #include "vm.h"
@@ -25,12 +27,17 @@
 #include "debug.h"
 #endif
 
+#define TRACE_EDGE_FRAMES 16
+
 VM vm;
 
 static void resetStack() {
     vm.stackTop = vm.stack;
     vm.frameCount = 0;
-    vm.openUpvalues = NULL;
+    for (int i = 0; i < vm.openUpvalueCount; i++) {
+        vm.upvalueSlots[vm.openUpvalues[i]->location - vm.stack] = NULL;
+    }
+    vm.openUpvalueCount = 0;
 }
 
 static void runtimeError(const char *format, ...) {
@@ -41,10 +48,26 @@ static void runtimeError(const char *format, ...) {
     fputs("\n", stderr);
 
     for (int i = vm.frameCount - 1; i >= 0; i--) {
+        // With deep recursion only both ends of the trace are worth printing.
+        if (i == vm.frameCount - 1 - TRACE_EDGE_FRAMES && i >= TRACE_EDGE_FRAMES) {
+            fprintf(stderr, "[... %d more frames]\n", i + 1 - TRACE_EDGE_FRAMES);
+            i = TRACE_EDGE_FRAMES - 1;
+        }
+
         const CallFrame *frame = &vm.frames[i];
         const ObjFunction *function = frame->closure->function;
-        const size_t instruction = frame->ip - function->chunk.code - 1;
-        const int line = getLine(&frame->closure->function->chunk, instruction);
+        const Chunk *chunk = &function->chunk;
+        const size_t instruction = frame->ip - chunk->code - 1;
+        int line = getLine(chunk, instruction);
+
+        // Inlined calls get the line the frame they replaced would have had.
+        for (int j = 0; j < chunk->inlineCount; j++) {
+            const InlineRange *range = &chunk->inlines[j];
+            if (instruction < (size_t) range->start || instruction >= (size_t) range->end) continue;
+            const ObjFunction *inlined = AS_FUNCTION(chunk->constants.values[range->function]);
+            fprintf(stderr, "[line %d] in %s()\n", line, inlined->name->chars);
+            line = range->line;
+        }
 
         fprintf(stderr, "[line %d] in ", line);
         if (function->name == NULL) {
@@ -57,22 +80,41 @@ static void runtimeError(const char *format, ...) {
     resetStack();
 }
 
-static void defineNative(const char *name, const NativeFn function) {
+static void defineNative(const char *name, const NativeFn function, const char *params) {
     push(OBJ_VAL(copyString(name, (int)strlen(name))));
-    push(OBJ_VAL(newNative(function)));
+    push(OBJ_VAL(newNative(function, name, params)));
     defineGlobal(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1], true);
     popn(2);
 }
 
 void initVM() {
+    vm.frames = malloc(sizeof(CallFrame) * FRAMES_INITIAL);
+    vm.stack = malloc(sizeof(Value) * STACK_INITIAL);
+    vm.upvalueSlots = calloc(STACK_INITIAL, sizeof(ObjUpvalue *));
+    if (vm.frames == NULL || vm.stack == NULL || vm.upvalueSlots == NULL) exit(1);
+    vm.openUpvalues = NULL;
+    vm.openUpvalueCount = 0;
+    vm.openUpvalueCapacity = 0;
+    vm.frameCapacity = FRAMES_INITIAL;
+    vm.stackCapacity = STACK_INITIAL;
+    vm.stackBudget = STACK_BUDGET;
+
     resetStack();
+    vm.identityHashes.count = 0;
+    vm.identityHashes.capacity = 0;
+    vm.identityHashes.entries = NULL;
+    vm.identityHashes.nextHash = 0;
     vm.markValue = true;
+    vm.collecting = false;
     vm.bytesAllocated = 0;
     vm.nextGC = 1024 * 1024;
     vm.objects = NULL;
     vm.grayCount = 0;
     vm.grayCapacity = 0;
     vm.grayStack = NULL;
+    memset(vm.shortStrings, 0, sizeof(vm.shortStrings));
+    memset(vm.boundMethods, 0, sizeof(vm.boundMethods));
+    memset(vm.methodCache, 0, sizeof(vm.methodCache));
 
     initGlobals(&vm.globals);
     initTable(&vm.strings);
@@ -80,24 +122,29 @@ void initVM() {
     vm.initString = OBJ_VAL(NULL); // GC might try to collect un init memory in copyString.
     vm.initString = OBJ_VAL(copyString("init", 4));
 
-    defineNative("clock", clockNative);
-    defineNative("read", readNative);
-    defineNative("err", errNative);
-    defineNative("str", strNative);
-    defineNative("number", numberNative);
-    defineNative("tryNumber", tryNumberNative);
-    defineNative("bool", boolNative);
-    defineNative("sleep", sleepNative);
-    defineNative("joinStr", joinStrNative);
-    defineNative("hasProperty", hasPropertyNative);
-    defineNative("delProperty", delPropertyNative);
+    defineNative("clock", clockNative, "");
+    defineNative("read", readNative, NULL);
+    defineNative("err", errNative, NULL);
+    defineNative("str", strNative, "a");
+    defineNative("number", numberNative, "a");
+    defineNative("tryNumber", tryNumberNative, "a");
+    defineNative("bool", boolNative, "a");
+    defineNative("sleep", sleepNative, "n");
+    defineNative("joinStr", joinStrNative, NULL);
+    defineNative("hasProperty", hasPropertyNative, "is");
+    defineNative("delProperty", delPropertyNative, "is");
 }
 
 void freeVM() {
     vm.initString = OBJ_VAL(NULL); // GC will free the string
     freeObjects();
+    freeIdentityHashes();
     freeGlobals(&vm.globals);
     freeTable(&vm.strings);
+    free(vm.frames);
+    free(vm.stack);
+    free(vm.openUpvalues);
+    free(vm.upvalueSlots);
 }
 
 void push(const Value value) {
@@ -123,15 +170,75 @@ void replace(const Value value) {
     *(vm.stackTop - 1) = value;
 }
 
-static bool call(ObjClosure *closure, const uint8_t argCount) {
-    if (argCount != closure->function->arity) {
-        runtimeError("Expected %d arguments but got %d", closure->function->arity, argCount);
-        return false;
+static void relocateStack(Value *stack) {
+#define REBASE(pointer) (stack + ((pointer) - vm.stack))
+    vm.stackTop = REBASE(vm.stackTop);
+    for (int i = 0; i < vm.frameCount; i++) {
+        vm.frames[i].slots = REBASE(vm.frames[i].slots);
     }
 
-    if (vm.frameCount == FRAMES_MAX) {
-        runtimeError("Stack overflow.");
-        return false;
+    // Only open upvalues point into the stack, closed ones point at their own field.
+    for (int i = 0; i < vm.openUpvalueCount; i++) {
+        vm.openUpvalues[i]->location = REBASE(vm.openUpvalues[i]->location);
+    }
+#undef REBASE
+
+    vm.stack = stack;
+}
+
+/*
+ * Makes room for one more frame and its stack slots, returns false if that
+ * would take the stacks over vm.stackBudget.
+ * The value stack is a single block that gets moved, so nobody may hold a pointer
+ * into it across a call.
+ */
+static bool growStack(const int slots) {
+    int frameCapacity = vm.frameCapacity;
+    if (vm.frameCount == frameCapacity) {
+        frameCapacity = GROW_CAPACITY(frameCapacity);
+    }
+
+    const int stackNeeded = (int) (vm.stackTop - vm.stack) + slots;
+    int stackCapacity = vm.stackCapacity;
+    while (stackCapacity < stackNeeded) {
+        stackCapacity = GROW_CAPACITY(stackCapacity);
+    }
+
+    const size_t size = sizeof(CallFrame) * frameCapacity + (sizeof(Value) + sizeof(ObjUpvalue *)) * stackCapacity;
+    if (size > vm.stackBudget) return false;
+
+    if (frameCapacity != vm.frameCapacity) {
+        vm.frames = realloc(vm.frames, sizeof(CallFrame) * frameCapacity);
+        if (vm.frames == NULL) exit(1);
+        vm.frameCapacity = frameCapacity;
+    }
+
+    if (stackCapacity != vm.stackCapacity) {
+        // Copied instead of realloc'd so the old pointers stay valid while they are rebased.
+        Value *stack = malloc(sizeof(Value) * stackCapacity);
+        if (stack == NULL) exit(1);
+        memcpy(stack, vm.stack, sizeof(Value) * (vm.stackTop - vm.stack));
+
+        Value *old = vm.stack;
+        relocateStack(stack);
+        free(old);
+
+        vm.upvalueSlots = realloc(vm.upvalueSlots, sizeof(ObjUpvalue *) * stackCapacity);
+        if (vm.upvalueSlots == NULL) exit(1);
+        memset(vm.upvalueSlots + vm.stackCapacity, 0, sizeof(ObjUpvalue *) * (stackCapacity - vm.stackCapacity));
+        vm.stackCapacity = stackCapacity;
+    }
+
+    return true;
+}
+
+static inline bool pushFrame(ObjClosure *closure, const uint8_t argCount) {
+    const int slots = closure->function->stackSlots;
+    if (vm.frameCount == vm.frameCapacity || vm.stackTop + slots > vm.stack + vm.stackCapacity) {
+        if (!growStack(slots)) {
+            runtimeError("Stack overflow.");
+            return false;
+        }
     }
 
     CallFrame *frame = &vm.frames[vm.frameCount++];
@@ -141,6 +248,58 @@ static bool call(ObjClosure *closure, const uint8_t argCount) {
     return true;
 }
 
+static bool call(ObjClosure *closure, const uint8_t argCount) {
+    if (argCount != closure->function->arity) {
+        runtimeError("Expected %d arguments but got %d", closure->function->arity, argCount);
+        return false;
+    }
+    return pushFrame(closure, argCount);
+}
+
+static const char *nativeParamName(const char param) {
+    switch (param) {
+        case 'n': return "number";
+        case 's': return "string";
+        case 'i': return "instance";
+        default: return "value";
+    }
+}
+
+static bool nativeParamMatches(const char param, const Value value) {
+    switch (param) {
+        case 'n': return IS_NUMBER(value);
+        case 's': return IS_STRING(value);
+        case 'i': return IS_INSTANCE(value);
+        default: return true;
+    }
+}
+
+// Arity and argument types are checked here from the signature the native was defined with,
+// so the native itself only has to report errors that depend on the argument values.
+static inline bool callNative(const ObjNative *native, const int argCount) {
+    Value *args = vm.stackTop - argCount;
+    if (native->arity != NATIVE_VARIADIC) {
+        if (argCount != native->arity) {
+            runtimeError("Expected %d arguments but got %d", native->arity, argCount);
+            return false;
+        }
+        for (int i = 0; native->typed && i < argCount; i++) {
+            if (!nativeParamMatches(native->params[i], args[i])) {
+                runtimeError("Expected %s as argument %d of '%s'.",
+                             nativeParamName(native->params[i]), i + 1, native->name);
+                return false;
+            }
+        }
+    }
+
+    if (native->function(argCount, args)) {
+        vm.stackTop = args;
+        return true;
+    }
+    runtimeError("%s", AS_CSTRING(args[-1]));
+    return false;
+}
+
 static bool callValue(const Value callee, const uint8_t argCount) {
     if (IS_OBJ(callee)) {
         switch (OBJ_TYPE(callee)) {
@@ -163,15 +322,8 @@ static bool callValue(const Value callee, const uint8_t argCount) {
             }
             case OBJ_CLOSURE:
                 return call(AS_CLOSURE(callee), argCount);
-            case OBJ_NATIVE: {
-                const NativeFn native = AS_NATIVE(callee);
-                if (native(argCount, vm.stackTop - argCount)) {
-                    vm.stackTop -= argCount;
-                    return true;
-                }
-                runtimeError(AS_STRING(vm.stackTop[-argCount - 1])->chars);
-                return false;
-            }
+            case OBJ_NATIVE:
+                return callNative(AS_NATIVE(callee), argCount);
             default:
                 break;
         }
@@ -180,16 +332,38 @@ static bool callValue(const Value callee, const uint8_t argCount) {
     return false;
 }
 
-static bool invokeFromClass(const ObjClass *klass, const Value name, const int argCount) {
-    Value method;
-    if (!tableGet(&klass->methods, name, &method)) {
-        runtimeError("Undefined property '&s'.", AS_CSTRING(name));
+static MethodCacheEntry *methodCacheEntry(const ObjClass *klass, const ObjString *name) {
+    const uintptr_t key = (uintptr_t) klass >> 4 ^ name->hash;
+    return &vm.methodCache[key & (METHOD_CACHE_SIZE - 1)];
+}
+
+// Looks name up on klass and its superclasses, NULL if none of them has the method.
+static ObjClosure *findMethod(ObjClass *klass, ObjString *name) {
+    MethodCacheEntry *entry = methodCacheEntry(klass, name);
+    if (entry->klass == klass && entry->name == name) return entry->method;
+
+    for (const ObjClass *owner = klass; owner != NULL; owner = owner->superclass) {
+        Value method;
+        if (stringTableGet(&owner->methods, name, &method)) {
+            entry->klass = klass;
+            entry->name = name;
+            entry->method = AS_CLOSURE(method);
+            return entry->method;
+        }
+    }
+    return NULL;
+}
+
+static bool invokeFromClass(ObjClass *klass, ObjString *name, const int argCount) {
+    ObjClosure *method = findMethod(klass, name);
+    if (method == NULL) {
+        runtimeError("Undefined property '%s'.", name->chars);
         return false;
     }
-    return call(AS_CLOSURE(method), argCount);
+    return call(method, argCount);
 }
 
-static bool invoke(const Value name, const int argCount) {
+static bool invoke(ObjString *name, const int argCount) {
     const Value receiver = peek(argCount);
 
     if (!IS_INSTANCE(receiver)) {
@@ -200,7 +374,7 @@ static bool invoke(const Value name, const int argCount) {
     const ObjInstance *instance = AS_INSTANCE(receiver);
 
     Value value;
-    if (tableGet(&instance->fields, name, &value)) {
+    if (stringTableGet(&instance->fields, name, &value)) {
         vm.stackTop[-argCount - 1] = value;
         return callValue(value, argCount);
     }
@@ -208,50 +382,122 @@ static bool invoke(const Value name, const int argCount) {
     return invokeFromClass(instance->klass, name, argCount);
 }
 
-static bool bindMethod(const ObjClass *klass, const Value name) {
-    Value method;
-    if (!tableGet(&klass->methods, name, &method)) {
-        runtimeError("Undefined property '%s'.", AS_CSTRING(name));
+static bool bindMethod(ObjClass *klass, ObjString *name) {
+    ObjClosure *closure = findMethod(klass, name);
+    if (closure == NULL) {
+        runtimeError("Undefined property '%s'.", name->chars);
         return false;
     }
 
-    ObjBoundMethod *bound = newBoundMethod(peek(0), AS_CLOSURE(method));
+    // Reading the same method off the same instance again reuses the bound method.
+    Obj *receiver = AS_OBJ(peek(0));
+    const uintptr_t key = (uintptr_t) receiver >> 4 ^ (uintptr_t) closure >> 4;
+    ObjBoundMethod **slot = &vm.boundMethods[key & (BOUND_METHOD_CACHE_SIZE - 1)];
+
+    ObjBoundMethod *bound = *slot;
+    if (bound == NULL || AS_OBJ(bound->receiver) != receiver || bound->method != closure) {
+        bound = newBoundMethod(peek(0), closure);
+        *slot = bound;
+    }
+
     replace(OBJ_VAL(bound));
     return true;
 }
 
-static ObjUpvalue *captureUpvalue(Value *local) {
-    ObjUpvalue *prevUpvalue = NULL;
-    ObjUpvalue *upvalue = vm.openUpvalues;
-    while (upvalue != NULL && upvalue->location > local) {
-        prevUpvalue = upvalue;
-        upvalue = upvalue->next;
+/*
+ * Index of the first open upvalue whose location is not below local.
+ * Captures almost always happen in the innermost frame, so the end is checked first.
+ */
+static int findOpenUpvalue(const Value *local) {
+    int start = 0;
+    int end = vm.openUpvalueCount;
+    if (end == 0 || vm.openUpvalues[end - 1]->location < local) return end;
+
+    while (start < end) {
+        const int mid = (start + end) / 2;
+        if (vm.openUpvalues[mid]->location < local) {
+            start = mid + 1;
+        } else {
+            end = mid;
+        }
     }
+    return start;
+}
 
-    if (upvalue != NULL && upvalue->location == local) {
-        return upvalue;
+static ObjUpvalue *captureUpvalue(Value *local) {
+    ObjUpvalue **slot = &vm.upvalueSlots[local - vm.stack];
+    if (*slot != NULL) {
+        return *slot;
     }
 
     ObjUpvalue *createdUpvalue = newUpvalue(local);
-    createdUpvalue->next = upvalue;
-    if (prevUpvalue == NULL) {
-        vm.openUpvalues = createdUpvalue;
-    } else {
-        prevUpvalue->next = createdUpvalue;
+    *slot = createdUpvalue;
+
+    if (vm.openUpvalueCapacity < vm.openUpvalueCount + 1) {
+        vm.openUpvalueCapacity = GROW_CAPACITY(vm.openUpvalueCapacity);
+        vm.openUpvalues = realloc(vm.openUpvalues, sizeof(ObjUpvalue *) * vm.openUpvalueCapacity);
+        if (vm.openUpvalues == NULL) exit(1);
     }
+
+    const int index = findOpenUpvalue(local);
+    memmove(&vm.openUpvalues[index + 1], &vm.openUpvalues[index],
+            sizeof(ObjUpvalue *) * (vm.openUpvalueCount - index));
+    vm.openUpvalues[index] = createdUpvalue;
+    vm.openUpvalueCount++;
     return createdUpvalue;
 }
 
 static void closeUpvalues(const Value *last) {
-    while (vm.openUpvalues != NULL && vm.openUpvalues->location >= last) {
-        ObjUpvalue *upvalue = vm.openUpvalues;
+    while (vm.openUpvalueCount > 0 && vm.openUpvalues[vm.openUpvalueCount - 1]->location >= last) {
+        ObjUpvalue *upvalue = vm.openUpvalues[--vm.openUpvalueCount];
+        vm.upvalueSlots[upvalue->location - vm.stack] = NULL;
         upvalue->closed = *upvalue->location;
         upvalue->location = &upvalue->closed;
-        vm.openUpvalues = upvalue->next;
     }
 }
 
-static void defineMethod(const Value name) {
+/*
+ * Reuses the running frame for a call in tail position. The callee and its arguments
+ * are moved down over the frame, so tail recursion runs in constant stack space.
+ */
+static bool tailCall(ObjClosure *closure, const uint8_t argCount) {
+    if (argCount != closure->function->arity) {
+        runtimeError("Expected %d arguments but got %d", closure->function->arity, argCount);
+        return false;
+    }
+
+    CallFrame *frame = &vm.frames[vm.frameCount - 1];
+    closeUpvalues(frame->slots);
+    memmove(frame->slots, vm.stackTop - argCount - 1, sizeof(Value) * (argCount + 1));
+    vm.stackTop = frame->slots + argCount + 1;
+    frame->closure = closure;
+    frame->ip = closure->function->chunk.code;
+
+    // The frame was sized for the old arguments, the new ones may need more room.
+    const int slots = closure->function->stackSlots;
+    if (vm.stackTop + slots > vm.stack + vm.stackCapacity && !growStack(slots)) {
+        runtimeError("Stack overflow.");
+        return false;
+    }
+    return true;
+}
+
+static bool tailCallValue(const Value callee, const uint8_t argCount) {
+    if (IS_CLOSURE(callee)) {
+        return tailCall(AS_CLOSURE(callee), argCount);
+    }
+
+    if (IS_BOUND_METHOD(callee)) {
+        const ObjBoundMethod *bound = AS_BOUND_METHOD(callee);
+        vm.stackTop[-argCount - 1] = bound->receiver;
+        return tailCall(bound->method, argCount);
+    }
+
+    // Natives and classes take the normal path, the following OP_RETURN finishes the frame.
+    return callValue(callee, argCount);
+}
+
+static void defineMethod(ObjString *name) {
     const Value method = peek(0);
     ObjClass *klass = AS_CLASS(peek(1));
 
@@ -259,7 +505,9 @@ static void defineMethod(const Value name) {
     if (klass->init == NULL && closure->function->name == AS_STRING(vm.initString)) {
         klass->init = AS_CLOSURE(method);
     } else {
-        tableSet(&klass->methods, name, method);
+        stringTableSet(&klass->methods, name, method);
+        MethodCacheEntry *entry = methodCacheEntry(klass, name);
+        if (entry->klass == klass) entry->klass = NULL;
     }
 
     pop();
@@ -283,9 +531,12 @@ static void concatenate() {
 
     const ObjString *result = concatenateStrings(a->chars, a->length, b->chars, b->length);
 
+    // Growing the intern table can collect, the result is kept on the stack until it is in place.
     const Value resultVal = OBJ_VAL(result);
+    push(resultVal);
     tableSet(&vm.strings, resultVal, NIL_VAL);
     pop();
+    pop();
     replace(resultVal);
 }
 
@@ -311,7 +562,9 @@ static InterpretResult run() {
 #define READ_U16() (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
 #define READ_U24() (ip += 3, (int)((ip[-3] << 16) | (uint16_t)((ip[-2] << 8) | ip[-1])))
 #define READ_INDEX() (wideInstruction ? READ_U24() : READ_U8())
+#define READ_OFFSET() (wideInstruction ? READ_U24() : READ_U16())
 #define READ_CONSTANT() (frame->closure->function->chunk.constants.values[READ_INDEX()])
+#define READ_STRING() AS_STRING(READ_CONSTANT())
 #define BINARY_OP(valueType, op)                        \
     do                                                  \
     {                                                   \
@@ -466,30 +719,37 @@ static InterpretResult run() {
                 break;
             }
             case OP_GET_UPVALUE: {
-                uint8_t slot = READ_U8();
+                const int slot = READ_INDEX();
                 push(*frame->closure->upvalues[slot]->location);
                 break;
             }
             case OP_SET_UPVALUE: {
-                uint8_t slot = READ_U8();
+                const int slot = READ_INDEX();
                 *frame->closure->upvalues[slot]->location = peek(0);
                 break;
             }
+            case OP_GET_CAPTURED: {
+                const int slot = READ_INDEX();
+                push(closureCaptured(frame->closure)[slot]);
+                break;
+            }
             case OP_GET_PROPERTY: {
                 if (!IS_INSTANCE(peek(0))) {
+                    frame->ip = ip;
                     runtimeError("Only instances have properties.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
                 ObjInstance *instance = AS_INSTANCE(peek(0));
-                Value name = READ_CONSTANT();
+                ObjString *name = READ_STRING();
 
                 Value value;
-                if (tableGet(&instance->fields, name, &value)) {
+                if (stringTableGet(&instance->fields, name, &value)) {
                     replace(value);
                     break;
                 }
 
+                frame->ip = ip;
                 if (!bindMethod(instance->klass, name)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
@@ -498,19 +758,24 @@ static InterpretResult run() {
             }
             case OP_SET_PROPERTY: {
                 if (!IS_INSTANCE(peek(1))) {
+                    frame->ip = ip;
                     runtimeError("Only instances have properties.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
                 ObjInstance *instance = AS_INSTANCE(peek(1));
-                tableSet(&instance->fields, READ_CONSTANT(), peek(0));
+                if (stringTableSet(&instance->fields, READ_STRING(), peek(0))
+                    && instance->fields.count > instance->klass->fieldCount) {
+                    instance->klass->fieldCount = instance->fields.count;
+                }
                 Value value = pop();
                 replace(value);
                 break;
             }
             case OP_GET_SUPER: {
-                Value name = READ_CONSTANT();
+                ObjString *name = READ_STRING();
                 ObjClass *superclass = AS_CLASS(pop());
+                frame->ip = ip;
                 if (!bindMethod(superclass, name)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
@@ -603,43 +868,88 @@ static InterpretResult run() {
                 break;
             }
             case OP_JUMP: {
-                const uint16_t offset = READ_U16();
+                const int offset = READ_OFFSET();
                 ip += offset;
                 break;
             }
             case OP_JUMP_IF_TRUE: {
-                const uint16_t offset = READ_U16();
+                const int offset = READ_OFFSET();
                 if (isTruthy(peek(0)))
                     ip += offset;
                 break;
             }
             case OP_JUMP_IF_FALSE: {
-                const uint16_t offset = READ_U16();
+                const int offset = READ_OFFSET();
                 if (isFalsey(peek(0)))
                     ip += offset;
                 break;
             }
             case OP_JUMP_IF_NOT_EQUAL: {
-                const uint16_t offset = READ_U16();
+                const int offset = READ_OFFSET();
                 if (!valuesEqual(peek(0), peek(1)))
                     ip += offset;
                 break;
             }
+            case OP_SWITCH: {
+                // Jumps to the case for the subject on top of the stack.
+                const ObjJumpTable *table = AS_JUMP_TABLE(READ_CONSTANT());
+                ip = frame->closure->function->chunk.code + jumpTableTarget(table, peek(0));
+                break;
+            }
+            case OP_INLINE_GUARD: {
+                // Runs the inlined body only if the callee is still the function it was copied from.
+                const ObjFunction *function = AS_FUNCTION(READ_CONSTANT());
+                const int offset = READ_OFFSET();
+                const Value callee = peek(0);
+                if (IS_CLOSURE(callee) && AS_CLOSURE(callee)->function == function) {
+                    pop();
+                } else {
+                    ip += offset;
+                }
+                break;
+            }
             case OP_LOOP: {
-                const uint16_t offset = READ_U16();
+                const int offset = READ_OFFSET();
                 ip -= offset;
                 break;
             }
             case OP_LOOP_IF_FALSE: {
-                const uint16_t offset = READ_U16();
+                const int offset = READ_OFFSET();
                 if (isFalsey(peek(0)))
                     ip -= offset;
                 break;
             }
             case OP_CALL: {
+                const uint8_t argCount = READ_U8();
+                const Value callee = peek(argCount);
+                frame->ip = ip;
+                // Closures called with the right argument count skip the dispatch in callValue.
+                if (IS_CLOSURE(callee) && AS_CLOSURE(callee)->function->arity == argCount) {
+                    if (!pushFrame(AS_CLOSURE(callee), argCount)) {
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    frame = &vm.frames[vm.frameCount - 1];
+                    ip = frame->ip;
+                    break;
+                }
+                // Natives don't push a frame, so there is nothing to reload after the call.
+                if (IS_NATIVE(callee)) {
+                    if (!callNative(AS_NATIVE(callee), argCount)) {
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    break;
+                }
+                if (!callValue(callee, argCount)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                frame = &vm.frames[vm.frameCount - 1];
+                ip = frame->ip;
+                break;
+            }
+            case OP_TAIL_CALL: {
                 const uint8_t argCount = READ_U8();
                 frame->ip = ip;
-                if (!callValue(peek(argCount), argCount)) {
+                if (!tailCallValue(peek(argCount), argCount)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 frame = &vm.frames[vm.frameCount - 1];
@@ -647,7 +957,7 @@ static InterpretResult run() {
                 break;
             }
             case OP_INVOKE: {
-                Value method = READ_CONSTANT();
+                ObjString *method = READ_STRING();
                 int argCount = READ_U8();
                 frame->ip = ip;
                 if (!invoke(method, argCount)) {
@@ -658,7 +968,7 @@ static InterpretResult run() {
                 break;
             }
             case OP_SUPER_INVOKE: {
-                Value method = READ_CONSTANT();
+                ObjString *method = READ_STRING();
                 int argCount = READ_U8();
                 ObjClass *superclass = AS_CLASS(pop());
                 frame->ip = ip;
@@ -689,13 +999,26 @@ static InterpretResult run() {
                 ObjFunction *function = AS_FUNCTION(READ_CONSTANT());
                 ObjClosure *closure = newClosure(function);
                 push(OBJ_VAL(closure));
-                for (int i = 0; i < closure->upvalueCount; ++i) {
-                    uint8_t isLocal = READ_U8();
-                    uint8_t index = READ_U8();
-                    if (isLocal) {
-                        closure->upvalues[i] = captureUpvalue(frame->slots + index);
-                    } else {
-                        closure->upvalues[i] = frame->closure->upvalues[index];
+                ObjUpvalue **upvalues = closure->upvalues;
+                Value *captured = closureCaptured(closure);
+                for (int i = 0; i < closure->upvalueCount + closure->capturedCount; ++i) {
+                    const uint8_t flags = READ_U8();
+                    const int index = flags & UPVALUE_WIDE ? READ_U24() : READ_U8();
+                    switch (flags & ~UPVALUE_WIDE) {
+                        case UPVALUE_LOCAL:
+                            *upvalues++ = captureUpvalue(frame->slots + index);
+                            break;
+                        case 0:
+                            *upvalues++ = frame->closure->upvalues[index];
+                            break;
+                        case UPVALUE_LOCAL | UPVALUE_BY_VALUE:
+                            *captured++ = frame->slots[index];
+                            break;
+                        case UPVALUE_BY_VALUE:
+                            *captured++ = closureCaptured(frame->closure)[index];
+                            break;
+                        default:
+                            break; // Unreachable
                     }
                 }
                 break;
@@ -726,18 +1049,20 @@ static InterpretResult run() {
             case OP_INHERIT: {
                 Value superclass = peek(1);
                 if (!IS_CLASS(superclass)) {
+                    frame->ip = ip;
                     runtimeError("Superclass must be a class.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
                 ObjClass *subclass = AS_CLASS(peek(0));
                 subclass->superInit = AS_CLASS(superclass)->init;
-                tableAddAll(&AS_CLASS(superclass)->methods, &subclass->methods);
+                subclass->fieldCount = AS_CLASS(superclass)->fieldCount;
+                subclass->superclass = AS_CLASS(superclass);
                 pop();
                 break;
             }
             case OP_METHOD:
-                defineMethod(READ_CONSTANT());
+                defineMethod(READ_STRING());
                 break;
             default:
                 break; // Unreachable
@@ -745,23 +1070,48 @@ static InterpretResult run() {
     }
 
 #undef BINARY_OP
+#undef READ_STRING
 #undef READ_CONSTANT
+#undef READ_OFFSET
 #undef READ_INDEX
 #undef READ_U24
 #undef READ_U16
 #undef READ_U8
 }
 
-InterpretResult interpret(const char *source) {
-    ObjFunction *function = compile(source);
-    if (function == NULL)
-        return INTERPRET_COMPILE_ERROR;
-
+static InterpretResult runScript(ObjFunction *function) {
     push(OBJ_VAL(function));
     ObjClosure *closure = newClosure(function);
     pop();
     push(OBJ_VAL(closure));
-    call(closure, 0);
+    if (!call(closure, 0)) return INTERPRET_RUNTIME_ERROR;
 
     return run();
 }
+
+InterpretResult interpret(const char *source, const size_t length) {
+    ObjFunction *function = compile(source, length);
+    if (function == NULL)
+        return INTERPRET_COMPILE_ERROR;
+
+    return runScript(function);
+}
+
+InterpretResult interpretReplInput(const char *source, const size_t length) {
+    bool incomplete;
+    ObjFunction *function = compileReplInput(source, length, &incomplete);
+    if (function == NULL)
+        return incomplete ? INTERPRET_INCOMPLETE : INTERPRET_COMPILE_ERROR;
+
+    return runScript(function);
+}
+
+InterpretResult interpretBytecode(const uint8_t *data, const size_t size) {
+    ObjFunction *function = readBytecode(data, size);
+    if (function == NULL) {
+        fprintf(stderr, "Invalid bytecode, it may have been written by another version of clox.\n");
+        return INTERPRET_COMPILE_ERROR;
+    }
+
+    return runScript(function);
+}
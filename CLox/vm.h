@@ -8,8 +8,19 @@
 #include "object.h"
 #include <stddef.h>
 
-#define FRAMES_MAX 64
-#define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
+#define BOUND_METHOD_CACHE_SIZE 256
+#define METHOD_CACHE_SIZE 1024
+
+#define FRAMES_INITIAL 16
+#define STACK_INITIAL (4 * UINT8_COUNT)
+
+// Slots a frame keeps above the deepest point of its code, for values the VM pushes inside an instruction.
+#define FRAME_EXTRA_SLOTS 4
+
+#ifndef STACK_BUDGET
+// Default upper bound in bytes for the frame and value stacks together.
+#define STACK_BUDGET (64 * 1024 * 1024)
+#endif
 
 typedef struct {
     ObjClosure *closure;
@@ -17,18 +28,45 @@ typedef struct {
     Value *slots;
 } CallFrame;
 
+// Result of looking up name on klass, which may have found the method on a superclass.
+typedef struct {
+    ObjClass *klass;
+    ObjString *name;
+    ObjClosure *method;
+} MethodCacheEntry;
+
 typedef struct {
-    CallFrame frames[FRAMES_MAX];
+    CallFrame *frames;
     int frameCount;
+    int frameCapacity;
 
-    Value stack[STACK_MAX];
+    // Grows by moving as a whole, pointers into it are rebased in growStack.
+    Value *stack;
     Value *stackTop;
+    int stackCapacity;
+    size_t stackBudget;
     Globals globals;
     Table strings;
     Value initString;
-    ObjUpvalue *openUpvalues;
+    // Interned on first use and kept alive as roots, index 0 is the empty string
+    // and index c + 1 the single character string c.
+    ObjString *shortStrings[UINT8_COUNT + 1];
+    // Sorted by stack slot, the upvalues of the innermost frame are at the end.
+    ObjUpvalue **openUpvalues;
+    int openUpvalueCount;
+    int openUpvalueCapacity;
+    // Open upvalue of every stack slot or NULL, same capacity as the stack.
+    ObjUpvalue **upvalueSlots;
+    // Recently bound methods, indexed by receiver and method. Weak, emptied on every collection.
+    ObjBoundMethod *boundMethods[BOUND_METHOD_CACHE_SIZE];
+    // Method lookups, indexed by class and name. Weak, emptied on every collection.
+    MethodCacheEntry methodCache[METHOD_CACHE_SIZE];
+
+    IdentityHashes identityHashes;
 
     bool markValue;
+    // Set while collectGarbage runs, the allocations it makes itself don't start another one.
+    bool collecting;
     size_t bytesAllocated;
     size_t nextGC;
     Obj *objects;
@@ -40,14 +78,22 @@ typedef struct {
 typedef enum {
     INTERPRET_OK,
     INTERPRET_COMPILE_ERROR,
-    INTERPRET_RUNTIME_ERROR
+    INTERPRET_RUNTIME_ERROR,
+    // The source ended in the middle of a declaration, only returned by interpretReplInput.
+    INTERPRET_INCOMPLETE
 } InterpretResult;
 
 extern VM vm;
 
 void initVM();
 
-InterpretResult interpret(const char *source);
+InterpretResult interpret(const char *source, size_t length);
+
+// Runs source typed into the REPL, which can go on in the next line if it is incomplete.
+InterpretResult interpretReplInput(const char *source, size_t length);
+
+// Runs a script saved by writeBytecode.
+InterpretResult interpretBytecode(const uint8_t *data, size_t size);
 
 void push(Value value);
 
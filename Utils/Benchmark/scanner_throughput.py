@@ -0,0 +1,63 @@
+import os
+import statistics
+import subprocess
+import tempfile
+import time
+
+# Configuration
+CLOX_PATH = "../../CLox/build/cmake-build-release-build/CLox"  # Path to your compiled clox executable
+TARGET_SIZE = 32 * 1024 * 1024  # Bytes of generated source
+WARM_UP = 2
+TRIALS = 5
+
+# Machine generated scripts are mostly long names, long strings, comments and indentation.
+BLOCK = """
+// Generated record {i}, the comment is here to pad the line out like generated code tends to do.
+var generated_record_identifier_number_{i}_with_a_long_descriptive_suffix = "value of record {i}, a string literal long enough to matter";
+    /* indented block comment
+       spanning two lines */
+        var generated_sum_{i} = {i} + 0.5 * {i};
+"""
+
+
+def generate_script(path):
+    written = 0
+    i = 0
+    with open(path, "w") as f:
+        while written < TARGET_SIZE:
+            block = BLOCK.format(i=i)
+            f.write(block)
+            written += len(block)
+            i += 1
+    return written
+
+
+def run_benchmark():
+    with tempfile.TemporaryDirectory() as directory:
+        script = os.path.join(directory, "generated.lox")
+        output = os.path.join(directory, "generated.loxc")
+        size = generate_script(script)
+
+        # Compiling without running measures the scanner and compiler alone.
+        command = [CLOX_PATH, "-c", script, output]
+        for i in range(WARM_UP):
+            subprocess.run(command, check=True)
+            print(f"  WarmUp {i + 1}")
+
+        times = []
+        for i in range(TRIALS):
+            start = time.perf_counter()
+            subprocess.run(command, check=True)
+            times.append(time.perf_counter() - start)
+            print(f"  Trial {i + 1}: {times[-1]:.4f}s")
+
+    megabytes = size / (1024 * 1024)
+    best = min(times)
+    print(f"\nSource:     {megabytes:.1f} MB")
+    print(f"Average:    {statistics.mean(times):.4f}s")
+    print(f"Best:       {best:.4f}s")
+    print(f"Throughput: {megabytes / best:.1f} MB/s")
+
+
+if __name__ == "__main__":
+    run_benchmark()